@@ -14,13 +14,66 @@
 #define WBSCRP_STRING_ALLOCATOR_HPP
 
 #include "memory_pool.hpp"
+#include "page_map.hpp"
+#include "size_classes.hpp"
+#include "system_memory.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <bit>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <limits>
+#include <memory>
 #include <mutex>
-#include <unordered_map>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+
+// Samples the allocations of pool_allocator and global_allocator_resource with the heap profiler, whatever the
+// reporters are
+#if defined(POOL_HEAP_PROFILER)
+#include "heap_profiler.hpp"
+#endif /*POOL_HEAP_PROFILER*/
+
+// Allocations above this size bypass the size class pools
+#ifndef POOL_LARGE_ALLOCATION_THRESHOLD
+#define POOL_LARGE_ALLOCATION_THRESHOLD 262144
+#endif /*POOL_LARGE_ALLOCATION_THRESHOLD*/
 
 namespace pool
 {
+#if defined(__clang__) || defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wglobal-constructors"
+#pragma GCC diagnostic ignored "-Wexit-time-destructors"
+#endif
+    // Protects the binding between the thread caches and their global allocator
+    inline std::mutex _thread_cache_mutex;
+#if defined(__clang__) || defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+    // Set when the thread cache of the thread is destroyed at thread exit. The destructors that run after it
+    // allocate without the cache, instead of registering a dead cache again
+    inline thread_local bool _thread_cache_destroyed { false };
+
+    // Number of allocators locked by lock_all() in this thread; _thread_cache_mutex is shared by all of them
+    inline thread_local std::size_t _lock_all_depth { 0 };
+
+    /// \brief How the background decay returns the idle memory of the pools to the system
+    struct decay_options
+    {
+        /// How often the pools are purged
+        std::chrono::milliseconds interval { 1000 };
+
+        /// Time to purge half of the idle memory. Zero purges all of it at every interval
+        std::chrono::milliseconds half_life { 10000 };
+    };
+
 #if defined(REPORT_ALLOCATIONS) && defined(CHECK_MEMORY_LEAK)
     template <allocator_reporter R, pool_reporter P>
 #elif !defined(REPORT_ALLOCATIONS) && defined(CHECK_MEMORY_LEAK)
@@ -48,79 +101,678 @@ namespace pool
 
         static constexpr auto pool_type_size_adjusted = static_cast<std::size_t>(static_cast<int>(2 << (std::bit_width(sizeof(pool_type)) - 1)));
 
+        // Chunks up to this size are cached per thread
+        static constexpr std::size_t max_cached_chunk_size = 16384;
+        static constexpr std::size_t max_cached_chunks     = 32;
+        static constexpr std::size_t cached_classes        = size_classes::index(max_cached_chunk_size) + 1;
+
+        // Allocations above this size are mapped directly from the system instead of using a pool
+        static constexpr std::size_t large_allocation_threshold   = POOL_LARGE_ALLOCATION_THRESHOLD;
+        static constexpr std::size_t large_allocation_granularity = 4096;
+        static constexpr std::size_t pooled_classes               = size_classes::index(large_allocation_threshold) + 1;
+
+        // Biggest alignment allocate(n, alignment) supports: large allocations are only aligned to the page
+        static constexpr std::size_t max_alignment = large_allocation_granularity;
+
+        // Upper bound of the block size of a pool
+        static constexpr std::size_t max_block_size = 2 << 20;
+
+        // Scratch memory of a purge of any pool: a bit for every chunk of the biggest block of the smallest chunks
+        static constexpr std::size_t max_purge_scratch_size = max_block_size / size_classes::min_chunk_size / 64 + 1;
+
+        static_assert(pooled_classes < 256, "the pages of the pools are tagged with their size class index plus one");
+
+    private:
+        /// \brief The pool of a single chunk size and the lock that protects it.
+        /// Aligned to a cache line, so threads using different size classes don't share it
+        struct alignas(64) size_class
+        {
+            std::mutex protection;
+            pool_type *pool { nullptr }; // Created on first use
+
+            // Chunks freed without taking the lock, linked through their first word. Any thread pushes with a
+            // single CAS, and the thread holding the lock takes the whole list on its next allocation.
+            // In its own cache line, so freeing threads don't contend with the lock
+            alignas(64) std::atomic<void *> remote_free { nullptr };
+
+            // Requests that didn't go through a thread cache, and the counters of the caches of finished threads
+            std::atomic<std::size_t> allocations { 0 };
+            std::atomic<std::size_t> deallocations { 0 };
+        };
+
+        /// \brief A stack of free chunks of a single size class owned by one thread
+        struct magazine
+        {
+            std::size_t count { 0 };
+            std::array<void *, max_cached_chunks> chunks {};
+
+            // Only written by the owner thread; atomic so stats() can read them from other threads
+            std::atomic<std::size_t> allocations { 0 };
+            std::atomic<std::size_t> deallocations { 0 };
+        };
+
+        /// \brief Per-thread chunks of every cached size class.
+        /// Most allocations and deallocations are served from here without taking any lock
+        struct thread_cache
+        {
+            thread_cache() = default;
+            thread_cache(const thread_cache &) = delete;
+            thread_cache &operator=(const thread_cache &) = delete;
+
+            ~thread_cache()
+            {
+                _thread_cache_destroyed = true;
+
+                // Drain the chunks back when the thread exits
+                std::unique_lock<std::mutex> lock(_thread_cache_mutex);
+                if (owner != nullptr)
+                    owner->detach_thread_cache(*this);
+            }
+
+            this_type *owner { nullptr };
+
+            // Registered caches of the owner
+            thread_cache *next_cache { nullptr };
+            thread_cache *previous_cache { nullptr };
+
+            std::array<magazine, cached_classes> magazines {};
+        };
+
+    public:
+        /// \brief Counters of a size class
+        struct size_class_stats
+        {
+            std::size_t chunk_size { 0 };
+            std::size_t allocations { 0 };   ///< Requests served, including the ones served by the thread caches
+            std::size_t deallocations { 0 }; ///< Chunks given back, including the ones kept by the thread caches
+            std::size_t live_chunks { 0 };   ///< Chunks in use by the program
+            pool_stats pool {};              ///< The chunks of the thread caches and the remote free list are in use for the pool
+        };
+
+        /// \brief Snapshot of the counters of the allocator
+        struct allocator_stats
+        {
+            std::array<size_class_stats, pooled_classes> size_classes {};
+            std::size_t large_allocations { 0 };
+            std::size_t large_deallocations { 0 };
+            std::size_t large_bytes { 0 };    ///< Memory of the large allocations in use
+            std::size_t reserved_bytes { 0 }; ///< Memory of the pools and the large allocations
+            std::size_t used_bytes { 0 };     ///< Memory of the chunks and large allocations in use by the program
+        };
+
+        /// \brief Options of the blocks of every pool unless others are given. Each size class keeps one empty block,
+        /// so a class that swings around a block boundary doesn't allocate and free a block on every swing. That idle
+        /// block is up to block_size bytes per size class, which purge() and the decay return to the system
+        static constexpr pool_options default_block_options { .retained_blocks = 1 };
+
         global_allocator() :
             global_block(32768, pool_type_size_adjusted)
         {
         }
 
-#ifdef REPORT_ALLOCATIONS
+        /// \brief An allocator that may skip the thread caches.
+        /// A thread caches the chunks of a single global_allocator, so threads that alternate between several
+        /// instances would drain their cache on every switch. Without the cache every request locks its size class
+        /// \param options Options of the blocks of every pool
+        explicit global_allocator(bool threadCache, pool_options options = default_block_options) :
+            global_block(32768, pool_type_size_adjusted, options), use_thread_cache(threadCache), block_options(options)
+        {
+        }
+
+        global_allocator(const global_allocator &)            = delete;
+        global_allocator &operator=(const global_allocator &) = delete;
+
         ~global_allocator()
         {
+            stop_decay();
+            release_thread_caches();
+            collect_remote_frees();
+
+            // The pools live in chunks of global_block, so they must be destroyed before global_block
+            for (auto &sizeClass : local_blocks)
+            {
+                if (sizeClass.pool != nullptr)
+                {
+                    sizeClass.pool->~pool_type();
+                    global_block.release(sizeClass.pool);
+                }
+            }
+
+#ifdef REPORT_ALLOCATIONS
             _reporter.global_freed(this);
-        }
 #endif /*REPORT_ALLOCATIONS*/
+        }
 
-        auto create_pool(std::size_t size, std::size_t chunkSize) noexcept -> auto
+        /// \brief Returns the chunks held by every thread cache to the pools and unbinds the caches.
+        /// Must only be called when no other thread is allocating from this allocator
+        auto release_thread_caches() -> void
         {
-            auto find = local_blocks.find(chunkSize);
-            if (find == local_blocks.end())
+            std::unique_lock<std::mutex> lock(_thread_cache_mutex);
+            while (caches != nullptr)
+                detach_thread_cache(*caches);
+        }
+
+        /// \brief Returns the chunks freed without lock to their pools.
+        /// They are collected anyway by the next allocation of their size class
+        auto collect_remote_frees() -> void
+        {
+            for (auto &sizeClass : local_blocks)
             {
-                local_blocks[chunkSize] = global_block.template alloc(size, chunkSize);
-                return local_blocks.find(chunkSize);
+                if (sizeClass.remote_free.load(std::memory_order_relaxed) == nullptr)
+                    continue;
+
+                std::unique_lock<std::mutex> lock(sizeClass.protection);
+                take_remote_frees(sizeClass, nullptr, 0);
             }
+        }
+
+        /// \brief Returns to the system the pages of the pools that hold no chunk in use.
+        /// The chunks cached by the threads are in use
+        /// \return The number of bytes purged
+        auto purge() -> std::size_t
+        {
+            // Allocated before any size class is locked: the allocator may be behind operator new and malloc
+            std::vector<uint64_t> released;
+            released.reserve(max_purge_scratch_size);
 
-            return find;
+            std::size_t purged = 0;
+            for (auto &sizeClass : local_blocks)
+            {
+                std::unique_lock<std::mutex> lock(sizeClass.protection);
+                if (sizeClass.pool != nullptr)
+                {
+                    take_remote_frees(sizeClass, nullptr, 0);
+                    purged += sizeClass.pool->purge(std::numeric_limits<std::size_t>::max(), released);
+                }
+            }
+            return purged;
         }
 
-        auto allocate(std::size_t n) -> void *
+        /// \brief Starts a thread that purges a fraction of the idle memory of every pool at each interval.
+        /// Size classes that are locked at that moment are skipped. The decay holds the lock of a size class only to
+        /// take its remote frees, compact its free lists and set the pages aside; the system calls run without it
+        auto start_decay(decay_options options = {}) -> void
+        {
+            stop_decay();
+
+            decay_stop   = false;
+            decay_thread = std::thread([this, options] { decay(options); });
+        }
+
+        auto stop_decay() -> void
+        {
+            if (!decay_thread.joinable())
+                return;
+
+            {
+                std::unique_lock<std::mutex> lock(decay_mutex);
+                decay_stop = true;
+            }
+            decay_signal.notify_all();
+            decay_thread.join();
+        }
+
+        /// \brief Counters of every size class and the large allocations.
+        /// The counters are always updated, with relaxed atomics that the threads don't share in the fast path
+        MP_NODISCARD auto stats() -> allocator_stats
         {
-            std::unique_lock<std::mutex> lock(thread_protection);
+            allocator_stats snapshot;
+
+            for (std::size_t i = 0; i < pooled_classes; ++i)
+            {
+                snapshot.size_classes[i].chunk_size    = size_classes::chunk_size(i);
+                snapshot.size_classes[i].allocations   = local_blocks[i].allocations.load(std::memory_order_relaxed);
+                snapshot.size_classes[i].deallocations = local_blocks[i].deallocations.load(std::memory_order_relaxed);
+            }
+
+            {
+                std::unique_lock<std::mutex> lock(_thread_cache_mutex);
+                for (auto *cache = caches; cache != nullptr; cache = cache->next_cache)
+                {
+                    for (std::size_t i = 0; i < cached_classes; ++i)
+                    {
+                        snapshot.size_classes[i].allocations += cache->magazines[i].allocations.load(std::memory_order_relaxed);
+                        snapshot.size_classes[i].deallocations += cache->magazines[i].deallocations.load(std::memory_order_relaxed);
+                    }
+                }
+            }
 
+            for (std::size_t i = 0; i < pooled_classes; ++i)
+            {
+                auto &classStats = snapshot.size_classes[i];
+
+                // A chunk may be freed by a thread before the allocation is counted by another one
+                classStats.live_chunks = classStats.allocations > classStats.deallocations ? classStats.allocations - classStats.deallocations : 0;
+                snapshot.used_bytes += classStats.live_chunks * classStats.chunk_size;
+
+                std::unique_lock<std::mutex> lock(local_blocks[i].protection);
+                if (local_blocks[i].pool != nullptr)
+                {
+                    classStats.pool = local_blocks[i].pool->stats();
+                    snapshot.reserved_bytes += classStats.pool.reserved_bytes;
+                }
+            }
+
+            snapshot.large_allocations   = large_allocations.load(std::memory_order_relaxed);
+            snapshot.large_deallocations = large_deallocations.load(std::memory_order_relaxed);
+            snapshot.large_bytes         = large_bytes.load(std::memory_order_relaxed);
+            snapshot.used_bytes += snapshot.large_bytes;
+
+            {
+                // The pools themselves live in global_block
+                std::unique_lock<std::mutex> lock(thread_protection);
+                snapshot.reserved_bytes += global_block.stats().reserved_bytes + snapshot.large_bytes;
+            }
+
+            return snapshot;
+        }
+
+        /// \brief Locks every mutex of the allocator. Called before fork(), so the child doesn't inherit a mutex
+        /// locked by a thread that doesn't exist there. The thread that locks must not allocate until unlock_all().
+        /// A thread may lock several allocators
+        auto lock_all() -> void
+        {
+            // Same order as the allocation paths: a size class is locked before global_block
+            if (_lock_all_depth++ == 0)
+                _thread_cache_mutex.lock();
+            for (auto &sizeClass : local_blocks)
+                sizeClass.protection.lock();
+            thread_protection.lock();
+        }
+
+        /// \brief Unlocks the mutexes locked by lock_all(), in the parent and in the child after fork()
+        auto unlock_all() -> void
+        {
+            thread_protection.unlock();
+            for (auto &sizeClass : local_blocks)
+                sizeClass.protection.unlock();
+            if (--_lock_all_depth == 0)
+                _thread_cache_mutex.unlock();
+        }
+
+        auto create_pool(std::size_t size, std::size_t chunkSize) -> pool_type *
+        {
+            if (chunkSize > large_allocation_threshold)
+                return nullptr; // Large allocations don't use pools
+
+            auto &sizeClass = local_blocks[size_class_index(chunkSize)];
+            std::unique_lock<std::mutex> lock(sizeClass.protection);
+            return pool_of(sizeClass, size, chunkSize);
+        }
+
+        auto allocate(std::size_t n) -> void *
+        {
             std::size_t chunk_size = this_type::adjust_chunk_size(n);
 
-            auto pool = create_pool(
-                this_type::usable_size_from_chunk_size(chunk_size),
-                chunk_size);
+            if (n > large_allocation_threshold)
+            {
+                void *p = system::map(chunk_size);
+                if (p != nullptr)
+                {
+                    large_allocations.fetch_add(1, std::memory_order_relaxed);
+                    large_bytes.fetch_add(chunk_size, std::memory_order_relaxed);
+                }
+                return p;
+            }
+
+            if (use_thread_cache && chunk_size <= max_cached_chunk_size && !_thread_cache_destroyed)
+            {
+                auto &chunks = local_cache().magazines[size_class_index(chunk_size)];
+                if (chunks.count == 0)
+                    refill(chunks, chunk_size);
+
+                count(chunks.allocations);
+                return chunks.chunks[--chunks.count];
+            }
+
+            // Only the size class is locked, allocations of other sizes can run at the same time
+            auto &sizeClass = local_blocks[size_class_index(chunk_size)];
+            sizeClass.allocations.fetch_add(1, std::memory_order_relaxed);
+            std::unique_lock<std::mutex> lock(sizeClass.protection);
+
+            void *chunk { nullptr };
+            if (take_remote_frees(sizeClass, &chunk, 1) == 1)
+                return chunk;
 
-            // The [ ] operator won't create pools because create_pool will do it if it doesn't exist
-            return pool->second->template alloc();
+            return pool_of(sizeClass, this_type::usable_size_from_chunk_size(chunk_size), chunk_size)->template alloc();
         }
 
 
+        /// \brief Chunk size of the pool whose blocks hold p, or 0 if no pool of this allocator does, like the memory
+        /// of a large allocation. Doesn't lock nor read the memory of p
+        MP_NODISCARD auto pooled_chunk_size(const void *p) const noexcept -> std::size_t
+        {
+            const auto tag = pages.find(p);
+            return tag == 0 ? 0 : size_classes::chunk_size(tag - 1u);
+        }
+
+        /// \brief Allocates n bytes aligned to alignment, a power of two up to max_alignment.
+        /// Deallocate it with adjust_chunk_size(n, alignment)
+        auto allocate(std::size_t n, std::size_t alignment) -> void *
+        {
+            if (!std::has_single_bit(alignment) || alignment > max_alignment)
+                throw std::runtime_error("alignment must be a power of two not greater than max_alignment");
+
+            return allocate(this_type::adjust_chunk_size(n, alignment));
+        }
+
         auto deallocate(void *p, std::size_t chunkSize) -> void
         {
-            std::unique_lock<std::mutex> lock(thread_protection);
+            if (use_thread_cache && chunkSize <= max_cached_chunk_size && !_thread_cache_destroyed)
+            {
+                auto &chunks = local_cache().magazines[size_class_index(chunkSize)];
+                if (chunks.count == cache_capacity(chunkSize))
+                    flush(chunks, chunkSize, cache_capacity(chunkSize) / 2);
+
+                count(chunks.deallocations);
+                chunks.chunks[chunks.count++] = p;
+                return;
+            }
 
-            auto find = local_blocks.find(chunkSize);
-            if (find != local_blocks.end())
+            if (chunkSize > large_allocation_threshold)
             {
-                find->second->release(p);
+                large_deallocations.fetch_add(1, std::memory_order_relaxed);
+                large_bytes.fetch_sub(chunkSize, std::memory_order_relaxed);
+                system::unmap(p, chunkSize);
+                return;
             }
-        }
 
+            auto &sizeClass = local_blocks[size_class_index(chunkSize)];
+            sizeClass.deallocations.fetch_add(1, std::memory_order_relaxed);
 
+            // Released right away if the size class is free, so the pool sees its empty blocks and retention_time
+            // applies. Under contention the chunk goes back with the next allocation, purge or decay of its size class
+            std::unique_lock<std::mutex> lock(sizeClass.protection, std::try_to_lock);
+            if (!lock.owns_lock())
+            {
+                push_remote_frees(sizeClass, p, p);
+                return;
+            }
 
-    public:
-        static constexpr auto adjust_chunk_size(std::size_t chunkSize) noexcept -> std::size_t
+            take_remote_frees(sizeClass, nullptr, 0);
+            sizeClass.pool->release(p);
+        }
+
+        /// \brief Resizes in place a chunk allocated with chunkSize, so it holds n bytes.
+        /// A pooled chunk only holds the sizes of its own size class; a large allocation grows over the free pages
+        /// after it if the system allows it, and always shrinks
+        /// \return true if the chunk now holds n bytes. From then on it must be deallocated with
+        /// adjust_chunk_size(n, alignment)
+        auto try_expand(void *p, std::size_t chunkSize, std::size_t n, std::size_t alignment = 1) noexcept -> bool
         {
-            std::size_t chunk_size;
-            if (chunkSize < 8)
-                chunk_size = 8;
+            const auto newChunkSize = this_type::adjust_chunk_size(n, alignment);
+            if (newChunkSize == chunkSize)
+                return true;
+
+            if (chunkSize <= large_allocation_threshold || newChunkSize <= large_allocation_threshold)
+                return false;
+
+            if (!system::remap(p, chunkSize, newChunkSize))
+                return false;
+
+            if (newChunkSize > chunkSize)
+                large_bytes.fetch_add(newChunkSize - chunkSize, std::memory_order_relaxed);
             else
+                large_bytes.fetch_sub(chunkSize - newChunkSize, std::memory_order_relaxed);
+            return true;
+        }
+
+        /// \brief Resizes a chunk allocated with chunkSize to hold n bytes, in place if possible. Otherwise the
+        /// contents move to a new chunk and the old one is deallocated
+        /// \return The chunk, to deallocate with adjust_chunk_size(n, alignment), or nullptr if the system is out of
+        /// memory, leaving p untouched
+        auto reallocate(void *p, std::size_t chunkSize, std::size_t n, std::size_t alignment = 1) -> void *
+        {
+            if (p == nullptr)
+                return allocate(n, alignment);
+
+            if (try_expand(p, chunkSize, n, alignment))
+                return p;
+
+            void *chunk = allocate(n, alignment);
+            if (chunk == nullptr)
+                return nullptr;
+
+            std::memcpy(chunk, p, std::min(chunkSize, n));
+            deallocate(p, chunkSize);
+            return chunk;
+        }
+
+    private:
+        /// \brief Index of the size class of a chunk size given by adjust_chunk_size
+        static constexpr auto size_class_index(std::size_t chunkSize) noexcept -> std::size_t
+        {
+            return size_classes::index(chunkSize);
+        }
+
+        /// \brief Increments a counter written by a single thread, without a locked instruction
+        static auto count(std::atomic<std::size_t> &counter) noexcept -> void
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        static constexpr auto cache_capacity(std::size_t chunkSize) noexcept -> std::size_t
+        {
+            // Keep at most 32 KiB per size class in each thread
+            return std::clamp<std::size_t>(32768 / chunkSize, 2, max_cached_chunks);
+        }
+
+        auto local_cache() -> thread_cache &
+        {
+            static thread_local thread_cache cache;
+
+            if (cache.owner != this)
+            {
+                // First use of this allocator in the thread
+                std::unique_lock<std::mutex> lock(_thread_cache_mutex);
+                if (cache.owner != nullptr)
+                    cache.owner->detach_thread_cache(cache);
+
+                cache.owner          = this;
+                cache.previous_cache = nullptr;
+                cache.next_cache     = caches;
+                if (caches != nullptr)
+                    caches->previous_cache = &cache;
+                caches = &cache;
+            }
+
+            return cache;
+        }
+
+        /// \brief Returns the pool of a size class, creating it if needed. The size class must be locked
+        auto pool_of(size_class &sizeClass, std::size_t size, std::size_t chunkSize) -> pool_type *
+        {
+            if (sizeClass.pool == nullptr)
             {
-                const auto bw = std::bit_width(chunkSize);
-                chunk_size    = static_cast<std::size_t>(static_cast<int>(2 << (bw - 1)));
+                // The blocks of the pool are tagged with its size class, for pooled_chunk_size
+                auto options     = block_options;
+                options.pages    = &pages;
+                options.page_tag = static_cast<uint8_t>(size_class_index(chunkSize) + 1);
+
+                // global_block is shared by all the size classes
+                std::unique_lock<std::mutex> lock(thread_protection);
+                sizeClass.pool = global_block.template alloc(size, chunkSize, options);
             }
 
-            return chunk_size;
+            return sizeClass.pool;
+        }
+
+        /// \brief Pushes the chunks linked from first to last to the remote free list of a size class
+        static auto push_remote_frees(size_class &sizeClass, void *first, void *last) noexcept -> void
+        {
+            auto *head = sizeClass.remote_free.load(std::memory_order_relaxed);
+            do
+                *static_cast<void **>(last) = head;
+            while (!sizeClass.remote_free.compare_exchange_weak(head, first, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        /// \brief Moves up to n chunks of the remote free list of a size class to chunks, and releases the rest to
+        /// the pool. The size class must be locked
+        /// \return The number of chunks moved
+        static auto take_remote_frees(size_class &sizeClass, void **chunks, std::size_t n) -> std::size_t
+        {
+            if (sizeClass.remote_free.load(std::memory_order_relaxed) == nullptr)
+                return 0;
+
+            // The whole list is taken at once, so there is no ABA problem with the pushing threads
+            auto *next = sizeClass.remote_free.exchange(nullptr, std::memory_order_acquire);
+
+            std::size_t taken = 0;
+            for (; next != nullptr && taken < n; ++taken)
+            {
+                chunks[taken] = next;
+                next          = *static_cast<void **>(next);
+            }
+
+            std::array<void *, max_cached_chunks> released;
+            std::size_t count = 0;
+            while (next != nullptr)
+            {
+                released[count++] = next;
+                next              = *static_cast<void **>(next);
+
+                if (count == released.size() || next == nullptr)
+                {
+                    sizeClass.pool->release_n(std::span<void *>(released.data(), count));
+                    count = 0;
+                }
+            }
+
+            return taken;
+        }
+
+        /// \brief Takes half a magazine of chunks, from the remote free list first, with a single lock
+        auto refill(magazine &chunks, std::size_t chunkSize) -> void
+        {
+            auto &sizeClass = local_blocks[size_class_index(chunkSize)];
+            std::unique_lock<std::mutex> lock(sizeClass.protection);
+
+            const auto batch = cache_capacity(chunkSize) / 2;
+            if (chunks.count < batch)
+                chunks.count += take_remote_frees(sizeClass, chunks.chunks.data() + chunks.count, batch - chunks.count);
+
+            if (chunks.count < batch)
+            {
+                auto *pool = pool_of(sizeClass, this_type::usable_size_from_chunk_size(chunkSize), chunkSize);
+                pool->alloc_n(std::span<void *>(chunks.chunks.data() + chunks.count, batch - chunks.count));
+                chunks.count = batch;
+            }
+        }
+
+        /// \brief Returns the oldest n chunks of the magazine to the remote free list with a single CAS.
+        /// Threads that only free, like the consumer of a queue, never take the lock of the size class
+        auto flush(magazine &chunks, std::size_t chunkSize, std::size_t n) -> void
+        {
+            for (std::size_t i = 0; i + 1 < n; ++i)
+                *static_cast<void **>(chunks.chunks[i]) = chunks.chunks[i + 1];
+
+            push_remote_frees(local_blocks[size_class_index(chunkSize)], chunks.chunks[0], chunks.chunks[n - 1]);
+
+            // Keep the most recently freed chunks, they are the hottest in the cache
+            std::copy(chunks.chunks.begin() + static_cast<std::ptrdiff_t>(n), chunks.chunks.begin() + static_cast<std::ptrdiff_t>(chunks.count), chunks.chunks.begin());
+            chunks.count -= n;
+        }
+
+        auto decay(decay_options options) -> void
+        {
+            // Exponential decay: after half_life, half of the idle memory is purged
+            const double fraction = options.half_life.count() > 0 ? 1.0 - std::exp2(-static_cast<double>(options.interval.count()) / static_cast<double>(options.half_life.count())) : 1.0;
+
+            // Allocated before any size class is locked: the allocator may be behind operator new and malloc
+            std::array<typename pool_type::purge_range, 32> ranges;
+            std::vector<uint64_t> released;
+            released.reserve(max_purge_scratch_size);
+
+            std::unique_lock<std::mutex> lock(decay_mutex);
+            while (!decay_signal.wait_for(lock, options.interval, [this] { return decay_stop; }))
+            {
+                for (auto &sizeClass : local_blocks)
+                {
+                    std::size_t count = 0;
+                    {
+                        std::unique_lock<std::mutex> classLock(sizeClass.protection, std::try_to_lock);
+                        if (!classLock.owns_lock() || sizeClass.pool == nullptr)
+                            continue;
+
+                        take_remote_frees(sizeClass, nullptr, 0);
+
+                        // At least a page, so the released chunks that purge compacts are purged in the next intervals
+                        const auto idle = static_cast<double>(sizeClass.pool->purgeable_bytes());
+                        count           = sizeClass.pool->begin_purge(std::max<std::size_t>(static_cast<std::size_t>(std::ceil(idle * fraction)), 1), ranges, released);
+                    }
+
+                    if (count == 0)
+                        continue;
+
+                    // The pages set aside are not handed out, so allocations of the size class go on meanwhile
+                    pool_type::purge_pages(std::span(ranges.data(), count));
+
+                    std::unique_lock<std::mutex> classLock(sizeClass.protection);
+                    sizeClass.pool->end_purge(std::span(ranges.data(), count));
+                }
+            }
+        }
+
+        /// \brief Drains a thread cache and unregisters it. _thread_cache_mutex must be held
+        auto detach_thread_cache(thread_cache &cache) -> void
+        {
+            for (std::size_t i = 0; i < cached_classes; ++i)
+            {
+                auto &chunks = cache.magazines[i];
+                if (chunks.count > 0)
+                    flush(chunks, size_classes::chunk_size(i), chunks.count);
+
+                // The counters of the thread are kept by the size class
+                local_blocks[i].allocations.fetch_add(chunks.allocations.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+                local_blocks[i].deallocations.fetch_add(chunks.deallocations.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+
+            if (cache.previous_cache != nullptr)
+                cache.previous_cache->next_cache = cache.next_cache;
+            else
+                caches = cache.next_cache;
+
+            if (cache.next_cache != nullptr)
+                cache.next_cache->previous_cache = cache.previous_cache;
+
+            cache.owner          = nullptr;
+            cache.next_cache     = nullptr;
+            cache.previous_cache = nullptr;
+        }
+
+    public:
+        /// \brief Chunk size used to allocate chunkSize bytes. Both allocation and deallocation must use this mapping
+        static constexpr auto adjust_chunk_size(std::size_t chunkSize) noexcept -> std::size_t
+        {
+            if (chunkSize > large_allocation_threshold)
+                return (chunkSize + large_allocation_granularity - 1) & ~(large_allocation_granularity - 1);
+
+            return size_classes::chunk_size(size_classes::index(chunkSize));
+        }
+
+        /// \brief Chunk size used to allocate chunkSize bytes aligned to alignment, a power of two up to max_alignment.
+        /// Chunks are aligned to the lowest set bit of their size, so it is the first size class that is a multiple
+        /// of the alignment. Large allocations are aligned to the page
+        static constexpr auto adjust_chunk_size(std::size_t chunkSize, std::size_t alignment) noexcept -> std::size_t
+        {
+            const auto adjusted = adjust_chunk_size(chunkSize);
+            if (chunkSize > large_allocation_threshold || (adjusted & (alignment - 1)) == 0)
+                return adjusted;
+
+            // Every doubling ends with a power of two size class, so the search always ends
+            auto index = size_classes::index(chunkSize);
+            while (size_classes::chunk_size(index) & (alignment - 1))
+                ++index;
+            return size_classes::chunk_size(index);
         }
 
         static constexpr auto usable_size_from_chunk_size(std::size_t chunkSize) noexcept -> std::size_t
         {
             auto usableSize = chunkSize * 1000;
 
-            if (usableSize > (2 << 19))
-                usableSize = chunkSize * 1000;
+            // Keep the blocks of big chunks bounded, but still big enough for a few chunks
+            if (usableSize > max_block_size)
+                usableSize = std::max<std::size_t>(max_block_size / chunkSize, 4) * chunkSize;
 
             return usableSize;
         }
@@ -137,9 +789,24 @@ namespace pool
 
     private:
         int64_t count_ref { 0 };
-        std::mutex thread_protection;
+        std::mutex thread_protection; // Protects global_block
+        page_map pages;               // Pages of the blocks of each size class; outlives the pools
         global_pool global_block;
-        std::unordered_map<std::size_t, pool_type *> local_blocks;
+        std::array<size_class, pooled_classes> local_blocks {};
+        thread_cache *caches { nullptr };
+        bool use_thread_cache { true };
+        pool_options block_options { default_block_options };
+
+        // Allocations mapped directly from the system
+        std::atomic<std::size_t> large_allocations { 0 };
+        std::atomic<std::size_t> large_deallocations { 0 };
+        std::atomic<std::size_t> large_bytes { 0 };
+
+        // Background decay
+        std::thread decay_thread;
+        std::mutex decay_mutex;
+        std::condition_variable decay_signal;
+        bool decay_stop { false };
 
 #if defined(REPORT_ALLOCATIONS) && defined(CHECK_MEMORY_LEAK)
         template <typename T, typename C, typename K>
@@ -172,6 +839,59 @@ namespace pool
 #pragma GCC diagnostic pop
 #endif
 
+#ifdef REPORT_ALLOCATIONS
+    /// \brief Whether a reporter is the heap profiler built in with POOL_HEAP_PROFILER, which is told only once
+    template <typename R>
+#if defined(POOL_HEAP_PROFILER)
+    inline constexpr bool is_builtin_profiler = std::is_same_v<R, heap_profiler>;
+#else
+    inline constexpr bool is_builtin_profiler = false;
+#endif /*POOL_HEAP_PROFILER*/
+#endif /*REPORT_ALLOCATIONS*/
+
+    /// \brief Tells about memory handed out by allocator to its reporter, if it has alloc_granted, and to the heap
+    /// profiler built in with POOL_HEAP_PROFILER
+    template <typename A>
+    inline void report_granted([[maybe_unused]] const A &allocator, [[maybe_unused]] const void *const p, [[maybe_unused]] std::size_t size)
+    {
+#ifdef REPORT_ALLOCATIONS
+        if constexpr (granted_memory_reporter<typename A::reporter_type> && !is_builtin_profiler<typename A::reporter_type>)
+            allocator.reporter().alloc_granted(p, size);
+#endif /*REPORT_ALLOCATIONS*/
+#if defined(POOL_HEAP_PROFILER)
+        heap_profiler::alloc_granted(p, size);
+#endif /*POOL_HEAP_PROFILER*/
+    }
+
+    /// \brief Tells about memory given back to allocator to its reporter and to the heap profiler built in with
+    /// POOL_HEAP_PROFILER
+    template <typename A>
+    inline void report_freed([[maybe_unused]] const A &allocator, [[maybe_unused]] const void *const p, [[maybe_unused]] std::size_t size)
+    {
+#ifdef REPORT_ALLOCATIONS
+        if constexpr (!is_builtin_profiler<typename A::reporter_type>)
+            allocator.reporter().dealloc_request(p, size);
+#endif /*REPORT_ALLOCATIONS*/
+#if defined(POOL_HEAP_PROFILER)
+        heap_profiler::dealloc_request(p, size);
+#endif /*POOL_HEAP_PROFILER*/
+    }
+
+#if defined(__cpp_lib_allocate_at_least)
+    /// \brief What allocate_at_least returns: the memory and the number of objects it really holds
+    template <typename Pointer>
+    using allocation_result = std::allocation_result<Pointer, std::size_t>;
+#else
+    /// \brief What allocate_at_least returns: the memory and the number of objects it really holds.
+    /// Same layout as std::allocation_result of C++23
+    template <typename Pointer>
+    struct allocation_result
+    {
+        Pointer ptr;
+        std::size_t count;
+    };
+#endif /*__cpp_lib_allocate_at_least*/
+
 #if defined(REPORT_ALLOCATIONS) && defined(CHECK_MEMORY_LEAK)
     template <typename T, typename R, typename P>
     struct pool_allocator
@@ -196,7 +916,19 @@ namespace pool
         using global_allocator = global_allocator;
 #endif
 
+        static_assert(alignof(T) <= global_allocator::max_alignment, "the pools can't align chunks beyond max_alignment");
+
     private:
+        /// \brief Chunk size of n objects, aligned to the alignment of T
+        static constexpr auto chunk_size_of(std::size_t n) noexcept -> std::size_t
+        {
+            // Every size class holds the multiples of the quantum with their alignment
+            if constexpr (alignof(T) <= size_classes::quantum)
+                return global_allocator::adjust_chunk_size(n * sizeof(T));
+            else
+                return global_allocator::adjust_chunk_size(n * sizeof(T), alignof(T));
+        }
+
         auto initialize_pool() -> void
         {
             std::unique_lock<std::mutex> lock(_construct_mutex);
@@ -240,13 +972,7 @@ namespace pool
 
                 if (global_allocator::_global->count_ref <= 0)
                 {
-                    // Since std::unordered_map will try to call the destructor of an allocated block
-                    // of a fixed_memory_pool chunk, this will cause a big set of troubles if we do not call release of each pool first
-                    for (auto &[chunk, block] : global_allocator::_global->local_blocks)
-                    {
-                        global_allocator::_global->global_block.release(block);
-                    }
-
+                    // No allocator is alive, so no thread can be using the global allocator
                     delete global_allocator::_global;
                     global_allocator::_global = nullptr;
                 }
@@ -312,31 +1038,64 @@ namespace pool
             global_allocator::_global->reporter().alloc_request(n * sizeof(T));
 #endif /*REPORT_ALLOCATIONS*/
 
-            if (auto *t = reinterpret_cast<value_type *>(global_allocator::_global->allocate(n * sizeof(value_type))); t)
+            if (auto *t = reinterpret_cast<value_type *>(global_allocator::_global->allocate(chunk_size_of(n))); t)
             {
+                report_granted(*global_allocator::_global, t, n * sizeof(T));
                 return t;
             }
 
             throw std::bad_alloc();
         }
 
-        auto deallocate(value_type *p, std::size_t _n) noexcept -> void
+        /// \brief Allocates at least n objects, and as many as fit in the chunk of their size class.
+        /// The memory can be deallocated with any number of objects between n and the count returned
+        MP_NODISCARD auto allocate_at_least(std::size_t n) -> allocation_result<value_type *>
         {
-            const std::size_t n = _n * sizeof(value_type);
+            assert(global_allocator::_global != nullptr);
+
+            if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+                throw std::bad_array_new_length();
+
+            const std::size_t chunkSize = chunk_size_of(n);
+            const std::size_t count     = chunkSize / sizeof(value_type);
+
 #ifdef REPORT_ALLOCATIONS
-            global_allocator::_global->reporter().dealloc_request(reinterpret_cast<void *>(p), n);
+            global_allocator::_global->reporter().alloc_request(n * sizeof(T));
 #endif /*REPORT_ALLOCATIONS*/
 
-            std::size_t chunk_size;
-            if (n < 8)
-                chunk_size = 8;
-            else
+            if (auto *t = reinterpret_cast<value_type *>(global_allocator::_global->allocate(chunkSize)); t)
             {
-                const auto bw = std::bit_width(n);
-                chunk_size    = static_cast<std::size_t>(static_cast<int>(2 << (bw - 1)));
+                report_granted(*global_allocator::_global, t, count * sizeof(T));
+                return { t, count };
             }
 
-            global_allocator::_global->deallocate(p, chunk_size);
+            throw std::bad_alloc();
+        }
+
+        /// \brief Resizes in place memory of n objects to hold newN objects, without moving them
+        /// \return true if the memory now holds newN objects, and must be deallocated with newN
+        auto try_expand(value_type *p, std::size_t n, std::size_t newN) noexcept -> bool
+        {
+            if (newN > std::numeric_limits<std::size_t>::max() / sizeof(T))
+                return false;
+
+            if (!global_allocator::_global->try_expand(p, chunk_size_of(n), newN * sizeof(value_type), alignof(value_type)))
+                return false;
+
+            // Reported as a new allocation at the same address
+            report_freed(*global_allocator::_global, p, n * sizeof(T));
+#ifdef REPORT_ALLOCATIONS
+            global_allocator::_global->reporter().alloc_request(newN * sizeof(T));
+#endif /*REPORT_ALLOCATIONS*/
+            report_granted(*global_allocator::_global, p, newN * sizeof(T));
+            return true;
+        }
+
+        auto deallocate(value_type *p, std::size_t _n) noexcept -> void
+        {
+            report_freed(*global_allocator::_global, p, _n * sizeof(value_type));
+
+            global_allocator::_global->deallocate(p, chunk_size_of(_n));
         }
 
         static auto get_global_allocator() -> auto
@@ -0,0 +1,460 @@
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// Created by Ricardo Romero on 16/10/26.
+// Copyright (c) 2026 Ricardo Romero.  All rights reserved.
+//
+
+#pragma once
+
+#ifndef __cplusplus
+#error "C++ compiler needed"
+#endif /*__cplusplus*/
+
+#ifndef WBSCRP_BITMAP_POOL_HPP
+#define WBSCRP_BITMAP_POOL_HPP
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif /*__AVX2__*/
+
+#include "page_map.hpp"
+
+#if !defined(MP_NODISCARD)
+#if __cplusplus >= 201603L
+#define MP_NODISCARD [[nodiscard]]
+#else
+#define MP_NODISCARD
+#endif
+#endif /*MP_NODISCARD*/
+
+namespace pool
+{
+    /// \brief A pool that tracks the chunks of each block in a bitmap instead of a free list inside the chunks.
+    /// Chunks may be as small as a byte, releasing a chunk twice is detected, and the live chunks can be visited.
+    /// A summary bitmap marks the words with free chunks, so the lowest free chunk is found with two tzcnt; the
+    /// summary of big blocks is scanned four words at a time with AVX2. Not thread safe, like memory_pool
+    template <typename T>
+    struct bitmap_pool
+    {
+    private:
+        using word_type = uint64_t;
+
+        static constexpr size_t word_bits = 64;
+
+        // chunk_shift of chunk sizes that are not a power of two
+        static constexpr size_t no_shift = ~size_t { 0 };
+
+        // Summary words scanned at once. The summary is padded to a multiple of it with zeros
+#if defined(__AVX2__)
+        static constexpr size_t scan_words = 4;
+#else
+        static constexpr size_t scan_words = 1;
+#endif /*__AVX2__*/
+
+        /// \brief Placed in the window of its block, right after the chunks, and followed by the summary and the bitmap
+        struct block final
+        {
+            size_t used_chunks { 0 };
+            size_t first_free_summary { 0 }; // No summary word before this one has a bit set
+
+            // Double linked list of every block
+            block *next_block { nullptr };
+            block *previous_block { nullptr };
+
+            // Double linked list of blocks with available chunks
+            block *next_partial { nullptr };
+            block *previous_partial { nullptr };
+
+            /// \brief One bit per word of the bitmap, set when the word has a free chunk
+            auto summary() noexcept -> word_type *
+            {
+                return reinterpret_cast<word_type *>(this + 1);
+            }
+
+            /// \brief One bit per chunk, set when the chunk is free. Placed after the summary
+            auto bitmap(size_t summaryWords) noexcept -> word_type *
+            {
+                return summary() + summaryWords;
+            }
+        };
+
+        static_assert(sizeof(block) % alignof(word_type) == 0, "the bitmap must be aligned after the block");
+
+    public:
+        explicit bitmap_pool(size_t blockSize, size_t chunk) :
+            block_size { blockSize },
+            chunk_size { chunk }
+        {
+            if (chunk_size == 0 || blockSize % chunk_size)
+                throw std::runtime_error("chunk size must fit in the block size");
+            if constexpr (!std::is_void_v<T>)
+            {
+                if (chunk_size % alignof(T))
+                    throw std::runtime_error("chunk size must be a multiple of the alignment of T");
+            }
+
+            chunk_shift       = std::has_single_bit(chunk_size) ? static_cast<size_t>(std::countr_zero(chunk_size)) : no_shift;
+            chunks_per_block  = block_size / chunk_size;
+            bitmap_words      = (chunks_per_block + word_bits - 1) / word_bits;
+            summary_words     = (bitmap_words + word_bits * scan_words - 1) / (word_bits * scan_words) * scan_words;
+            block_info_offset = (block_size + alignof(block) - 1) & ~(alignof(block) - 1);
+            block_memory_size = block_info_offset + sizeof(block) + (summary_words + bitmap_words) * sizeof(word_type);
+            block_alignment   = std::max(std::bit_ceil(block_memory_size), page_map::page_size); // A page holds the chunks of one block
+
+            allocate_block();
+        }
+
+        bitmap_pool(const bitmap_pool &)            = delete;
+        bitmap_pool &operator=(const bitmap_pool &) = delete;
+
+        ~bitmap_pool()
+        {
+            while (first_block != nullptr)
+            {
+                block *next = first_block->next_block;
+                std::free(block_memory(first_block));
+                first_block = next;
+            }
+
+            if (spare_block != nullptr)
+                std::free(block_memory(spare_block));
+        }
+
+        template <typename... Args>
+        auto alloc(Args &&...args) -> T *
+        {
+            void *chunk = get_available_chunk();
+            if constexpr (std::is_void_v<T>)
+                return chunk;
+            else
+                return new (chunk) T(std::forward<Args>(args)...);
+        }
+
+        /// \brief Destroys the object and frees its chunk
+        /// \param ptr The object; it is set to nullptr
+        void release(T *&ptr)
+        {
+            if (ptr == nullptr)
+                return;
+
+            block *used_block  = block_from_pointer(ptr);
+            const size_t index = chunk_index(used_block, ptr);
+            const size_t w     = index / word_bits;
+            auto &word         = used_block->bitmap(summary_words)[w];
+            const auto bit     = word_type { 1 } << (index % word_bits);
+
+            if (word & bit)
+                throw std::runtime_error("chunk released twice");
+
+            if constexpr (!std::is_void_v<T> && std::is_destructible_v<T> && !std::is_trivially_destructible_v<T>)
+                ptr->~T();
+
+            const bool wasFull = used_block->used_chunks == chunks_per_block;
+
+            word |= bit;
+            used_block->summary()[w / word_bits] |= word_type { 1 } << (w % word_bits);
+            used_block->first_free_summary = std::min(used_block->first_free_summary, w / word_bits);
+            --used_block->used_chunks;
+            --live_chunks;
+
+            if (used_block->used_chunks == 0 && (used_block->previous_block != nullptr || used_block->next_block != nullptr))
+            {
+                // The block is empty, and it is not the only block in the pool
+                if (!wasFull)
+                    unlink_partial(used_block);
+                unlink_block(used_block);
+                retire_block(used_block);
+            }
+            else if (wasFull)
+            {
+                link_partial(used_block);
+            }
+
+            ptr = nullptr;
+        }
+
+        /// \brief Whether the chunk of p is in use. Throws if p is not a chunk of the pool
+        MP_NODISCARD auto is_live(T *p) const -> bool
+        {
+            block *used_block  = block_from_pointer(p);
+            const size_t index = chunk_index(used_block, p);
+            return (used_block->bitmap(summary_words)[index / word_bits] & (word_type { 1 } << (index % word_bits))) == 0;
+        }
+
+        /// \brief Calls f with every chunk in use, block by block in address order inside each block
+        template <typename F>
+        void for_each_live(F &&f)
+        {
+            for (block *pBlock = first_block; pBlock != nullptr; pBlock = pBlock->next_block)
+            {
+                if (pBlock->used_chunks == 0)
+                    continue;
+
+                auto *chunks = static_cast<uint8_t *>(block_memory(pBlock));
+                for (size_t w = 0; w * word_bits < chunks_per_block; ++w)
+                {
+                    // Bits past the last chunk are zero in the bitmap, so they are masked out
+                    const size_t valid = std::min(word_bits, chunks_per_block - w * word_bits);
+                    word_type live     = ~pBlock->bitmap(summary_words)[w] & (valid == word_bits ? ~word_type { 0 } : (word_type { 1 } << valid) - 1);
+                    while (live != 0)
+                    {
+                        const auto bit = static_cast<size_t>(std::countr_zero(live));
+                        live &= live - 1;
+                        f(reinterpret_cast<T *>(chunks + (w * word_bits + bit) * chunk_size));
+                    }
+                }
+            }
+        }
+
+        MP_NODISCARD auto get_chunk_size() const noexcept -> size_t
+        {
+            return chunk_size;
+        }
+
+        /// \brief Alignment of every chunk: the lowest set bit of the chunk size
+        MP_NODISCARD auto chunk_alignment() const noexcept -> size_t
+        {
+            return std::min(chunk_size & (~chunk_size + 1), block_alignment);
+        }
+
+        MP_NODISCARD auto chunks_in_block() const noexcept -> size_t
+        {
+            return chunks_per_block;
+        }
+
+        /// \brief Chunks in use
+        MP_NODISCARD auto size() const noexcept -> size_t
+        {
+            return live_chunks;
+        }
+
+        MP_NODISCARD auto block_count() const noexcept -> size_t
+        {
+            size_t count = 0;
+            for (block *pBlock = first_block; pBlock != nullptr; pBlock = pBlock->next_block)
+                ++count;
+            return count;
+        }
+
+    private:
+        auto block_memory(block *pBlock) const noexcept -> void *
+        {
+            return reinterpret_cast<uint8_t *>(pBlock) - block_info_offset;
+        }
+
+        auto allocate_block() -> block *
+        {
+            block *pBlock = spare_block;
+            spare_block   = nullptr;
+
+            if (pBlock == nullptr)
+            {
+                void *memory { nullptr };
+                if (posix_memalign(&memory, block_alignment, block_memory_size) != 0)
+                    throw std::runtime_error("block: out of memory");
+
+                pBlock = new (static_cast<uint8_t *>(memory) + block_info_offset) block;
+
+                // Keep track of the addresses spanned by the pool, so we can quickly reject foreign pointers
+                const auto beginning = reinterpret_cast<uintptr_t>(memory);
+                if (lowest_address == 0 || beginning < lowest_address)
+                    lowest_address = beginning;
+                if (beginning + block_size > highest_address)
+                    highest_address = beginning + block_size;
+            }
+
+            // From now on, pointers inside the block are accepted. Only a new block may need memory for the map
+            if (!live_pages.assign(block_memory(pBlock), block_size, 1))
+            {
+                std::free(block_memory(pBlock));
+                throw std::runtime_error("block: out of memory");
+            }
+
+            // Every chunk is free, and so every word of the bitmap. The bits after the last ones are not
+            fill_bits(pBlock->summary(), summary_words, bitmap_words);
+            fill_bits(pBlock->bitmap(summary_words), bitmap_words, chunks_per_block);
+
+            pBlock->used_chunks        = 0;
+            pBlock->first_free_summary = 0;
+
+            // Link the new block at the beginning of the block list
+            pBlock->previous_block = nullptr;
+            pBlock->next_block     = first_block;
+            if (first_block != nullptr)
+                first_block->previous_block = pBlock;
+            first_block = pBlock;
+
+            link_partial(pBlock);
+
+            return pBlock;
+        }
+
+        /// \brief Keeps one empty block to absorb allocations that go back and forth across a block boundary
+        void retire_block(block *pBlock)
+        {
+            static_cast<void>(live_pages.assign(block_memory(pBlock), block_size, 0));
+
+            if (spare_block == nullptr)
+                spare_block = pBlock;
+            else
+                std::free(block_memory(pBlock));
+        }
+
+        void unlink_block(block *pBlock) noexcept
+        {
+            if (pBlock->previous_block != nullptr)
+                pBlock->previous_block->next_block = pBlock->next_block;
+            else
+                first_block = pBlock->next_block;
+
+            if (pBlock->next_block != nullptr)
+                pBlock->next_block->previous_block = pBlock->previous_block;
+        }
+
+        void link_partial(block *pBlock) noexcept
+        {
+            pBlock->previous_partial = nullptr;
+            pBlock->next_partial     = partial_blocks;
+            if (partial_blocks != nullptr)
+                partial_blocks->previous_partial = pBlock;
+            partial_blocks = pBlock;
+        }
+
+        void unlink_partial(block *pBlock) noexcept
+        {
+            if (pBlock->previous_partial != nullptr)
+                pBlock->previous_partial->next_partial = pBlock->next_partial;
+            else
+                partial_blocks = pBlock->next_partial;
+
+            if (pBlock->next_partial != nullptr)
+                pBlock->next_partial->previous_partial = pBlock->previous_partial;
+
+            pBlock->next_partial     = nullptr;
+            pBlock->previous_partial = nullptr;
+        }
+
+        /// \brief Sets the first count bits of words, and clears the rest
+        static void fill_bits(word_type *words, size_t size, size_t count) noexcept
+        {
+            std::memset(words, 0xFF, count / word_bits * sizeof(word_type));
+            std::memset(words + count / word_bits, 0, (size - count / word_bits) * sizeof(word_type));
+            if (count % word_bits)
+                words[count / word_bits] = (word_type { 1 } << (count % word_bits)) - 1;
+        }
+
+        /// \brief Index of the first summary word with a bit set. The block must have a free chunk
+        static auto find_free_summary(block *pBlock) noexcept -> size_t
+        {
+            const auto *summary = pBlock->summary();
+
+            // Blocks of up to 4096 chunks have a single summary word
+            size_t s = pBlock->first_free_summary;
+            if (summary[s] != 0)
+                return s;
+
+#if defined(__AVX2__)
+            // Test four words at once; the summary is padded to a multiple of four words
+            s &= ~(scan_words - 1);
+            while (true)
+            {
+                const auto words = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(summary + s));
+                if (!_mm256_testz_si256(words, words))
+                    break;
+                s += scan_words;
+            }
+#endif /*__AVX2__*/
+            while (summary[s] == 0)
+                ++s;
+            return s;
+        }
+
+        auto get_available_chunk() -> void *
+        {
+            // The head of the partial list always has available chunks
+            block *current_block = partial_blocks;
+            if (current_block == nullptr)
+                current_block = allocate_block();
+
+            // The lowest free chunk of the block, so the chunks in use stay packed at its beginning
+            const size_t s = find_free_summary(current_block);
+            auto &summary  = current_block->summary()[s];
+            const size_t w = s * word_bits + static_cast<size_t>(std::countr_zero(summary));
+            auto &word     = current_block->bitmap(summary_words)[w];
+            const auto bit = static_cast<size_t>(std::countr_zero(word));
+
+            word &= word - 1;
+            if (word == 0)
+                summary &= summary - 1;
+            current_block->first_free_summary = s;
+            ++current_block->used_chunks;
+            ++live_chunks;
+
+            // A full block can't serve more allocations
+            if (current_block->used_chunks == chunks_per_block)
+                unlink_partial(current_block);
+
+            return static_cast<uint8_t *>(block_memory(current_block)) + (w * word_bits + bit) * chunk_size;
+        }
+
+        auto block_from_pointer(const void *ptr) const -> block *
+        {
+            const auto address = reinterpret_cast<uintptr_t>(ptr);
+
+            // Reject anything outside the address span of the pool or pointing past the chunks of its window
+            if (address < lowest_address || address >= highest_address || (address & (block_alignment - 1)) >= block_size)
+                throw std::out_of_range("block does not belong to the pool");
+
+            // The span has gaps and the spare block is not in use, so the page is checked before the block is read
+            if (live_pages.find(ptr) == 0)
+                throw std::out_of_range("block does not belong to the pool");
+
+            // Get the block of the chunk by masking the address with the window alignment
+            return reinterpret_cast<block *>((address & ~(block_alignment - 1)) + block_info_offset);
+        }
+
+        auto chunk_index(block *pBlock, const void *ptr) const -> size_t
+        {
+            const auto offset = static_cast<size_t>(static_cast<const uint8_t *>(ptr) - static_cast<const uint8_t *>(block_memory(pBlock)));
+
+            // Power of two chunk sizes avoid the division
+            const size_t index = chunk_shift != no_shift ? offset >> chunk_shift : offset / chunk_size;
+            if (index * chunk_size != offset)
+                throw std::out_of_range("pointer is not the beginning of a chunk");
+            return index;
+        }
+
+        block *first_block { nullptr };
+        block *partial_blocks { nullptr }; // Blocks that are not full. Allocations are served from the head
+        block *spare_block { nullptr };    // An empty block kept for reuse
+
+        size_t block_size { 0 };
+        size_t chunk_size { 0 };
+        size_t chunk_shift { no_shift };
+        size_t chunks_per_block { 0 };
+        size_t bitmap_words { 0 };
+        size_t summary_words { 0 };
+        size_t block_info_offset { 0 };
+        size_t block_memory_size { 0 }; // Chunks, block information, summary and bitmap
+        size_t block_alignment { 0 };
+
+        uintptr_t lowest_address { 0 };
+        uintptr_t highest_address { 0 };
+        page_map live_pages; // Pages of the blocks in use
+
+        size_t live_chunks { 0 };
+    };
+
+} // namespace pool
+
+#endif // WBSCRP_BITMAP_POOL_HPP
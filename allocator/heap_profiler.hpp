@@ -0,0 +1,280 @@
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// Created by Ricardo Romero on 16/10/26.
+// Copyright (c) 2026 Ricardo Romero.  All rights reserved.
+//
+
+#pragma once
+
+#ifndef __cplusplus
+#error "C++ compiler needed"
+#endif /*__cplusplus*/
+
+#ifndef WBSCRP_HEAP_PROFILER_HPP
+#define WBSCRP_HEAP_PROFILER_HPP
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define POOL_HEAP_PROFILER_BACKTRACE
+#endif /*__has_include(<execinfo.h>)*/
+
+namespace pool
+{
+    /// \brief Sampling heap profiler, used as the allocator reporter of pool_allocator.
+    /// Allocations are sampled with a Poisson process on the allocated bytes: on average, one sample every
+    /// sampling_interval() bytes. A sample keeps the stack of the allocation until the memory is deallocated, and
+    /// write_profile() dumps the sampled live heap in the legacy pprof heap format (heap_v2).
+    /// Unsampled deallocations only read a shared counter, so the profiler can stay enabled in production
+    struct heap_profiler
+    {
+        static constexpr std::size_t default_sampling_interval = 512 * 1024;
+        static constexpr std::size_t max_stack_depth           = 64;
+
+        /// \brief Average number of bytes between samples. Zero disables the sampling
+        inline static void set_sampling_interval(std::size_t bytes) noexcept
+        {
+            sampling_interval_bytes.store(bytes, std::memory_order_relaxed);
+            sampling_epoch.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        inline static auto sampling_interval() noexcept -> std::size_t
+        {
+            return sampling_interval_bytes.load(std::memory_order_relaxed);
+        }
+
+        /// \brief Number of sampled allocations that are still alive
+        inline static auto live_samples() -> std::size_t
+        {
+            std::unique_lock<std::mutex> lock(profile_mutex);
+            return samples.size();
+        }
+
+        /// \brief Estimated bytes held by the live allocations, unbiased from the sampled ones
+        inline static auto estimated_live_bytes() -> double
+        {
+            std::unique_lock<std::mutex> lock(profile_mutex);
+
+            double bytes = 0;
+            for (const auto &[p, s] : samples)
+                bytes += static_cast<double>(s.size) / inclusion_probability(s.size, s.interval);
+            return bytes;
+        }
+
+        /// \brief Writes the live samples, aggregated by stack, in the legacy pprof heap format
+        inline static void write_profile(std::ostream &out)
+        {
+            struct site
+            {
+                std::size_t count { 0 };
+                std::size_t bytes { 0 };
+            };
+
+            std::map<std::vector<void *>, site> sites;
+            std::size_t count = 0;
+            std::size_t bytes = 0;
+            std::size_t interval;
+            {
+                std::unique_lock<std::mutex> lock(profile_mutex);
+                for (const auto &[p, s] : samples)
+                {
+                    auto &callSite = sites[std::vector<void *>(s.stack.begin(), s.stack.begin() + static_cast<std::ptrdiff_t>(s.depth))];
+                    ++callSite.count;
+                    callSite.bytes += s.size;
+                    ++count;
+                    bytes += s.size;
+                }
+                interval = sampling_interval();
+            }
+
+            // pprof unsamples heap_v2 profiles with the sampling interval, so the raw sampled values are written.
+            // There is no allocation history, so the cumulative values are the live ones
+            out << "heap profile: " << count << ": " << bytes << " [" << count << ": " << bytes << "] @ heap_v2/" << interval << "\n";
+            for (const auto &[stack, callSite] : sites)
+            {
+                out << callSite.count << ": " << callSite.bytes << " [" << callSite.count << ": " << callSite.bytes << "] @";
+                for (auto *frame : stack)
+                    out << " 0x" << std::hex << reinterpret_cast<uintptr_t>(frame) << std::dec;
+                out << "\n";
+            }
+
+#if defined(__linux__)
+            // pprof symbolizes the addresses with the mapped libraries
+            out << "\nMAPPED_LIBRARIES:\n";
+            std::ifstream maps("/proc/self/maps");
+            out << maps.rdbuf();
+#endif /*__linux__*/
+        }
+
+        /// \brief Forgets every sample
+        inline static void reset()
+        {
+            std::unique_lock<std::mutex> lock(profile_mutex);
+            samples.clear();
+            for (auto &filter : sampled_filter)
+                filter.store(0, std::memory_order_relaxed);
+        }
+
+        // allocator_reporter
+
+        inline static void global_new(void *) noexcept
+        {
+        }
+
+        inline static void global_freed(void *) noexcept
+        {
+        }
+
+        inline static void add_ref_count(int64_t) noexcept
+        {
+        }
+
+        inline static void sub_ref_count(int64_t) noexcept
+        {
+        }
+
+        inline static void copy_ctor_ref_count(int64_t) noexcept
+        {
+        }
+
+        inline static void move_ctor_ref_count(int64_t) noexcept
+        {
+        }
+
+        inline static void alloc_request(std::size_t) noexcept
+        {
+        }
+
+        inline static void alloc_granted(const void *const p, std::size_t size) noexcept
+        {
+            auto &state = thread_state();
+
+            // Draw again when the interval changed, or the first time the thread allocates
+            if (state.epoch != sampling_epoch.load(std::memory_order_relaxed))
+                state.reset();
+
+            state.bytes_until_sample -= static_cast<int64_t>(size);
+            if (state.bytes_until_sample >= 0 || state.interval == 0)
+                return;
+
+            state.bytes_until_sample = state.next_sample();
+            record(p, size, state.interval);
+        }
+
+        inline static void dealloc_request(const void *const p, std::size_t) noexcept
+        {
+            // Only the sampled pointers take the lock
+            if (sampled_filter[filter_index(p)].load(std::memory_order_relaxed) == 0)
+                return;
+
+            std::unique_lock<std::mutex> lock(profile_mutex);
+            if (samples.erase(p) > 0)
+                sampled_filter[filter_index(p)].fetch_sub(1, std::memory_order_relaxed);
+        }
+
+    private:
+        struct sample
+        {
+            std::size_t size { 0 };
+            std::size_t interval { 0 };
+            std::size_t depth { 0 };
+            std::array<void *, max_stack_depth> stack {};
+        };
+
+        struct sampler
+        {
+            std::mt19937_64 random { std::random_device {}() ^ std::hash<std::thread::id> {}(std::this_thread::get_id()) };
+            std::size_t interval { 0 };
+            std::size_t epoch { 0 };
+            int64_t bytes_until_sample { 0 };
+
+            void reset()
+            {
+                epoch              = sampling_epoch.load(std::memory_order_relaxed);
+                interval           = sampling_interval();
+                bytes_until_sample = next_sample();
+            }
+
+            // The distance between samples of a Poisson process is exponentially distributed
+            auto next_sample() -> int64_t
+            {
+                if (interval == 0)
+                    return std::numeric_limits<int64_t>::max();
+
+                return static_cast<int64_t>(std::exponential_distribution<double> { 1.0 / static_cast<double>(interval) }(random));
+            }
+        };
+
+        static auto thread_state() noexcept -> sampler &
+        {
+            static thread_local sampler state;
+            return state;
+        }
+
+        /// \brief Probability that an allocation of size bytes is sampled
+        static auto inclusion_probability(std::size_t size, std::size_t interval) noexcept -> double
+        {
+            return 1.0 - std::exp(-static_cast<double>(size) / static_cast<double>(interval));
+        }
+
+        static auto filter_index(const void *const p) noexcept -> std::size_t
+        {
+            return static_cast<std::size_t>((reinterpret_cast<uintptr_t>(p) >> 4) * 0x9E3779B97F4A7C15ull >> 52) % sampled_filter.size();
+        }
+
+        static void record(const void *const p, std::size_t size, std::size_t interval) noexcept
+        {
+            sample s;
+            s.size     = size;
+            s.interval = interval;
+#ifdef POOL_HEAP_PROFILER_BACKTRACE
+            s.depth = static_cast<std::size_t>(backtrace(s.stack.data(), static_cast<int>(s.stack.size())));
+#endif /*POOL_HEAP_PROFILER_BACKTRACE*/
+
+            try
+            {
+                std::unique_lock<std::mutex> lock(profile_mutex);
+                if (samples.insert_or_assign(p, s).second)
+                    sampled_filter[filter_index(p)].fetch_add(1, std::memory_order_relaxed);
+            }
+            catch (...)
+            {
+                // Losing a sample is better than failing the allocation
+            }
+        }
+
+#if defined(__clang__) || defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wglobal-constructors"
+#pragma GCC diagnostic ignored "-Wexit-time-destructors"
+#endif
+        inline static std::atomic<std::size_t> sampling_interval_bytes { default_sampling_interval };
+        inline static std::atomic<std::size_t> sampling_epoch { 1 };
+
+        inline static std::mutex profile_mutex;
+        inline static std::unordered_map<const void *, sample> samples;
+
+        // Number of live samples per pointer hash; a zero means the pointer is not sampled
+        inline static std::array<std::atomic<uint32_t>, 4096> sampled_filter {};
+#if defined(__clang__) || defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+    };
+
+} // namespace pool
+
+#endif // WBSCRP_HEAP_PROFILER_HPP
@@ -13,9 +13,18 @@
 #ifndef MEMPOOL_FIXPOOL_BLOCK_HPP
 #define MEMPOOL_FIXPOOL_BLOCK_HPP
 
+#include <algorithm>
 #include <bit>
+#include <chrono>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <memory>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #if defined(__APPLE__)
 #include <unistd.h>
 #elif defined(__linux__) || defined(__MINGW32__)
@@ -25,7 +34,9 @@
 #include <windows.h>
 #endif /**/
 
+#include "page_map.hpp"
 #include "pool_concept.hpp"
+#include "system_memory.hpp"
 
 #if __cplusplus >= 201603L
 #define MP_NODISCARD [[nodiscard]]
@@ -35,6 +46,49 @@
 
 namespace pool
 {
+    /// \brief Where the memory of the blocks comes from
+    enum class block_backing
+    {
+        heap,       ///< Regular pages from the heap
+        huge_pages, ///< 2 MiB pages mapped from the system, falling back to regular pages if huge pages are not available
+        mapped      ///< Regular pages mapped from the system, so the pool never calls malloc
+    };
+
+    /// \brief Snapshot of the counters of a memory pool
+    struct pool_stats
+    {
+        size_t allocations { 0 };       ///< Chunks handed out
+        size_t releases { 0 };          ///< Chunks released
+        size_t live_chunks { 0 };       ///< Chunks in use
+        size_t blocks { 0 };            ///< Blocks in use, plus the only block of the pool even if it is empty
+        size_t retained_blocks { 0 };   ///< Empty blocks kept for reuse
+        size_t block_allocations { 0 }; ///< Blocks requested from the system
+        size_t block_frees { 0 };       ///< Blocks returned to the system
+        size_t reserved_bytes { 0 };    ///< Memory of every block, including the retained ones
+        size_t used_bytes { 0 };        ///< Memory of the chunks in use
+    };
+
+    /// \brief Run-time options of a memory pool
+    struct pool_options
+    {
+        /// Fill every chunk with zeros before handing it out
+        bool zero_fill { false };
+
+        /// Maximum number of empty blocks kept by the pool to serve future allocations instead of being freed.
+        /// Each one holds block_size bytes while idle. Zero frees a block as soon as it is empty
+        size_t retained_blocks { 0 };
+
+        /// How long an empty block is kept. Zero keeps the block until the pool needs it or is destroyed
+        std::chrono::milliseconds retention_time { 0 };
+
+        /// Memory used for the blocks. With huge pages, the block size is rounded to fill whole huge pages
+        block_backing backing { block_backing::heap };
+
+        /// Map where the pages of every block in use are tagged with page_tag, so the pool of a pointer is found
+        /// without reading it. Without one the pool tags a map of its own. Not owned, it must outlive the pool
+        page_map *pages { nullptr };
+        uint8_t page_tag { 1 };
+    };
 
 #if defined(REPORT_ALLOCATIONS) || defined(CHECK_MEMORY_LEAK)
     template <typename T, pool_reporter P, bool dest=true>
@@ -59,10 +113,14 @@ namespace pool
             size_t available_chunks { 0 };
             size_t used_chunks { 0ull };
 
-            size_t *next_free_chunk { nullptr };
+            size_t *next_free_chunk { nullptr };    // Chunks released by the user
+            uint8_t *next_untouched_chunk { nullptr }; // Chunks that were never handed out, up to block_end
             uint8_t *block_beginning { nullptr };
             uint8_t *block_end { nullptr };
 
+            // Pages above this address and above next_untouched_chunk are not resident; used by purge
+            uint8_t *dirty_end { nullptr };
+
 #ifdef _DEBUG
             // Just for debugging purposes
             [[maybe_unused]] size_t *block_beginning_ { nullptr };
@@ -71,20 +129,65 @@ namespace pool
             // Double linked list
             block *next_block { nullptr };
             block *previous_block { nullptr };
-        } *first_block;
+
+            // Double linked list of blocks with available chunks
+            block *next_partial { nullptr };
+            block *previous_partial { nullptr };
+
+            // When the block became empty and was retained by the pool
+            std::chrono::steady_clock::time_point retained_since {};
+        } *first_block { nullptr };
+
+        // Blocks that are not full. Allocations are always served from the head of this list
+        block *partial_blocks { nullptr };
+
+        // Empty blocks kept by the retention policy. Linked through next_block/previous_block, newest first
+        block *retained_first { nullptr };
+        block *retained_last { nullptr };
+
+        // Each block is placed at the beginning of a power-of-two aligned window, and the block
+        // information lives right after the chunks. Masking any chunk address with the window
+        // alignment gives us the block, without walking the list
+        static constexpr auto block_info_offset(size_t blockSize) noexcept -> size_t
+        {
+            return (blockSize + alignof(block) - 1) & ~(alignof(block) - 1);
+        }
 
     public:
-        explicit memory_pool(size_t blockSize, size_t chunk) :
+        explicit memory_pool(size_t blockSize, size_t chunk, pool_options options = {}) :
             block_size { blockSize },
-            chunk_size { chunk }
+            chunk_size { chunk },
+            pool_config { options }
         {
 
             if (blockSize % chunk_size)
                 throw std::runtime_error("chunk size must fit in the block size");
             if (!(chunk_size >= sizeof(void *)))
                 throw std::runtime_error("chunk size must be at least the size of void *");
+            if constexpr (!std::is_void_v<T>)
+            {
+                // Chunks are aligned to the lowest set bit of their size, so over-aligned types need a multiple of it
+                if (chunk_size % alignof(T))
+                    throw std::runtime_error("chunk size must be a multiple of the alignment of T");
+            }
+
+            block_memory_size = block_info_offset(block_size) + sizeof(block);
 
-            allocate_block(&first_block, nullptr);
+            if (pool_config.backing == block_backing::huge_pages)
+            {
+                // Use every chunk that fits in whole huge pages, together with the block information
+                block_memory_size = (block_memory_size + system::huge_page_size - 1) & ~(system::huge_page_size - 1);
+                block_size        = std::max(block_size, (block_memory_size - sizeof(block) - (alignof(block) - 1)) / chunk_size * chunk_size);
+            }
+
+            if (pool_config.page_tag == 0)
+                throw std::runtime_error("page tag must not be 0");
+
+            // A tagged page must not hold the chunks of two blocks
+            block_alignment = std::max(std::bit_ceil(block_memory_size), page_map::page_size);
+            pages           = pool_config.pages != nullptr ? pool_config.pages : &own_pages;
+
+            allocate_block();
         }
 
         ~memory_pool()
@@ -109,108 +212,418 @@ namespace pool
                 // free the current block
                 free_block(currentBlock);
             }
+
+            // The retained blocks are empty
+            while (retained_last != nullptr)
+                free_block(pop_retained_block());
         }
 
     protected:
-        void allocate_block(block **pBlock, block *previous)
+        auto allocate_block() -> block *
         {
-            *pBlock = new block(block_size, chunk_size); // Call the block constructor to initialize all the internal variables
+            block *pBlock;
+            if (retained_first != nullptr)
+            {
+                // Reuse the newest empty block instead of asking the system for more memory
+                pBlock = retained_first;
+                retained_first = pBlock->next_block;
+                if (retained_first != nullptr)
+                    retained_first->previous_block = nullptr;
+                else
+                    retained_last = nullptr;
+                --retained_count;
+                ++retained_hits;
+            }
+            else
+            {
+                pBlock = create_block();
+            }
+
+            // From now on, pointers inside the block are accepted. Only a new block may need memory for the map
+            if (!pages->assign(pBlock->_block, block_size, pool_config.page_tag))
+            {
+                free_block(pBlock);
+                throw std::runtime_error("block: out of memory");
+            }
+
+            // Chunks are handed out from the beginning of the block, and the free list only holds released chunks.
+            // This way we never touch a page of the block until a chunk that lives in it is used
+            pBlock->next_free_chunk      = nullptr;
+            pBlock->block_beginning      = static_cast<uint8_t *>(pBlock->_block);
+            pBlock->next_untouched_chunk = pBlock->block_beginning;
+            pBlock->block_end            = pBlock->block_beginning + block_size;
+
+            // Link the new block at the beginning of the block list
+            pBlock->previous_block = nullptr;
+            pBlock->next_block     = first_block;
+            if (first_block != nullptr)
+                first_block->previous_block = pBlock;
+            first_block = pBlock;
+
+            // The new block is empty, so it will serve the next allocations
+            link_partial(pBlock);
+
+#ifdef _DEBUG
+            // Just for debugging purposes
+            pBlock->block_beginning_ = static_cast<size_t *>(pBlock->_block);
+#endif /*_DEBUG*/
 
-            if (*pBlock == nullptr)
-                throw std::runtime_error("block info: out of memory");
+            return pBlock;
+        }
 
-            (*pBlock)->_block = std::aligned_alloc(chunk_size, block_size);
+        auto create_block() -> block *
+        {
+            void *memory { nullptr };
+            if (pool_config.backing != block_backing::heap)
+                memory = system::map_aligned(block_memory_size, block_alignment, pool_config.backing == block_backing::huge_pages);
+            else if (posix_memalign(&memory, block_alignment, block_memory_size) != 0)
+                memory = nullptr;
 
-            if ((*pBlock)->_block == nullptr)
+            if (memory == nullptr)
                 throw std::runtime_error("block: out of memory");
 
+            // Call the block constructor to initialize all the internal variables
+            // The block information is stored at the end of the chunks, inside the same window
+            auto *pBlock = new (static_cast<uint8_t *>(memory) + block_info_offset(block_size)) block(block_size, chunk_size);
+
+            pBlock->_block = memory;
+
+            // Fresh mappings are not resident, but the heap may hand us memory that was already used
+            pBlock->dirty_end = static_cast<uint8_t *>(memory) + (pool_config.backing == block_backing::heap ? block_size : 0);
+
+            // Keep track of the addresses spanned by the pool, so we can quickly reject foreign pointers
+            const auto beginning = reinterpret_cast<uintptr_t>(memory);
+            if (lowest_address == 0 || beginning < lowest_address)
+                lowest_address = beginning;
+            if (beginning + block_size > highest_address)
+                highest_address = beginning + block_size;
+
+            ++counters.block_allocations;
+
 #ifdef REPORT_ALLOCATIONS
-            reporter.allocate_block(*pBlock, block_size, chunk_size);
+            reporter.allocate_block(pBlock, block_size, chunk_size);
 #endif /*REPORT_ALLOCATIONS*/
 
-            memset((*pBlock)->_block, 0, block_size);
+            return pBlock;
+        }
 
-            // Init the free list
-            (*pBlock)->next_free_chunk = static_cast<size_t *>((*pBlock)->_block);
-            (*pBlock)->block_beginning = static_cast<uint8_t *>((*pBlock)->_block);
-            (*pBlock)->block_end       = (*pBlock)->block_beginning + block_size;
-            (*pBlock)->previous_block  = previous;
+        /// \brief Keeps an empty block for future allocations or frees it, according to the retention policy
+        void retire_block(block *pBlock)
+        {
+            // Clearing never maps memory, the leaves of the block are there
+            static_cast<void>(pages->assign(pBlock->_block, block_size, 0));
 
-#ifdef _DEBUG
-            // Just for debugging purposes
-            (*pBlock)->block_beginning_ = static_cast<size_t *>((*pBlock)->_block);
-#endif /*_DEBUG*/
+            // Every page the block handed out may be resident
+            pBlock->dirty_end = std::max(pBlock->dirty_end, pBlock->next_untouched_chunk);
 
-            // Will use size_t * in order to be able to store addresses at the beginning of the block
-            auto *currentChunk = reinterpret_cast<size_t *>((*pBlock)->_block);
+            if (pool_config.retained_blocks == 0)
+            {
+                free_block(pBlock);
+                return;
+            }
 
-            for (size_t n = 0; n < (*pBlock)->available_chunks; ++n)
+            // Link the block at the beginning of the retained list
+            pBlock->previous_block = nullptr;
+            pBlock->next_block     = retained_first;
+            if (retained_first != nullptr)
+                retained_first->previous_block = pBlock;
+            else
+                retained_last = pBlock;
+            retained_first = pBlock;
+            ++retained_count;
+
+            if (pool_config.retention_time.count() > 0)
             {
+                pBlock->retained_since = std::chrono::steady_clock::now();
+                trim_retained_blocks(pBlock->retained_since);
+            }
 
-#ifdef CHECK_MEMORY_ALIGNMENT
-                if (reinterpret_cast<uint64_t>(currentChunk) % sizeof(void *))
-                    throw std::runtime_error("block not aligned"); // Check the free-list alignment
-                if (reinterpret_cast<uint64_t>(currentChunk) % chunk_size)
-                    throw std::runtime_error("block not aligned"); // Check the chunk-size alignment
+            // Free the oldest blocks that exceed the limit
+            while (retained_count > pool_config.retained_blocks)
+                free_block(pop_retained_block());
+        }
 
-#endif
-                // Write the addresses of the available blocks which will point to the next chunk
-                if (n == ((*pBlock)->available_chunks - 1))
-                {
-                    *currentChunk = reinterpret_cast<uint64_t>(nullptr); // Last block must be nullptr
-                }
-                else
-                {
-                    // nextChunk will be used to read the address of the next chunk
-                    // Let's use uint8_t because if the data size is less than the pointer size this will truncate
+        /// \brief Unlinks the oldest retained block
+        auto pop_retained_block() noexcept -> block *
+        {
+            block *pBlock = retained_last;
+            unlink_retained_block(pBlock);
+            return pBlock;
+        }
+
+        void unlink_retained_block(block *pBlock) noexcept
+        {
+            if (pBlock->previous_block != nullptr)
+                pBlock->previous_block->next_block = pBlock->next_block;
+            else
+                retained_first = pBlock->next_block;
 
-                    uint8_t *nextChunk = reinterpret_cast<uint8_t *>((*pBlock)->next_free_chunk) + (chunk_size * (n + 1));
+            if (pBlock->next_block != nullptr)
+                pBlock->next_block->previous_block = pBlock->previous_block;
+            else
+                retained_last = pBlock->previous_block;
 
-                    *currentChunk = reinterpret_cast<size_t>(nextChunk);
-                    currentChunk  = reinterpret_cast<size_t *>(nextChunk);
-                }
-            }
+            --retained_count;
+        }
+
+        /// \brief Links a retained block at the end of the retained list, as the oldest one
+        void append_retained_block(block *pBlock) noexcept
+        {
+            pBlock->next_block     = nullptr;
+            pBlock->previous_block = retained_last;
+            if (retained_last != nullptr)
+                retained_last->next_block = pBlock;
+            else
+                retained_first = pBlock;
+            retained_last = pBlock;
+            ++retained_count;
+        }
+
+        void trim_retained_blocks(std::chrono::steady_clock::time_point now)
+        {
+            // The oldest blocks are at the end of the list
+            while (retained_last != nullptr && now - retained_last->retained_since >= pool_config.retention_time)
+                free_block(pop_retained_block());
         }
 
         void free_block(block *pBlock)
         {
-            auto _free = [](auto *ptr) {
-                if (ptr)
-                {
-                    if constexpr (std::is_same_v<decltype(ptr), block *>)
-                        delete ptr;
-                    else
-                        free(ptr);
-                }
-            };
+            // The block information lives inside the memory we are about to free
+            void *memory = pBlock->_block;
+            pBlock->~block();
+
+            // Live blocks are freed too when the pool is destroyed
+            static_cast<void>(pages->assign(memory, block_size, 0));
+
+            if (pool_config.backing != block_backing::heap)
+                system::unmap_aligned(memory, block_memory_size);
+            else
+                free(memory);
 
-            _free(pBlock->_block);
-            _free(pBlock);
+            ++counters.block_frees;
 
 #ifdef REPORT_ALLOCATIONS
             reporter.deallocate_block(pBlock, block_size, chunk_size);
 #endif /*REPORT_ALLOCATIONS*/
         }
 
-        block *block_from_pointer(T *ptr)
+        /// \brief Granularity of the purged memory
+        MP_NODISCARD auto purge_page_size() const noexcept -> size_t
         {
-            // Get the block of the current chunk
-            block *next        = first_block;
-            auto *freedAddress = reinterpret_cast<uint8_t *>(ptr);
-            while (next != nullptr)
+            return pool_config.backing == block_backing::huge_pages ? system::huge_page_size : system::page_size();
+        }
+
+        /// \brief Whole pages of a block from the lowest chunk not in use up to the highest page that may be resident.
+        /// The page with the block information is never included
+        auto dirty_pages(const block *pBlock, const uint8_t *lowestFree) const noexcept -> std::pair<uint8_t *, uint8_t *>
+        {
+            const auto page    = purge_page_size();
+            const auto first   = (reinterpret_cast<uintptr_t>(lowestFree) + page - 1) & ~(page - 1);
+            const auto highest = (reinterpret_cast<uintptr_t>(std::max<const uint8_t *>(pBlock->dirty_end, lowestFree)) + page - 1) & ~(page - 1);
+            const auto last    = std::min(highest, reinterpret_cast<uintptr_t>(pBlock) & ~(page - 1));
+
+            return { reinterpret_cast<uint8_t *>(first), reinterpret_cast<uint8_t *>(std::max(first, last)) };
+        }
+
+        /// \brief Purges up to maxBytes of the dirty pages of a block above lowestFree, starting from the top
+        auto purge_block(block *pBlock, const uint8_t *lowestFree, size_t maxBytes) -> size_t
+        {
+            auto [first, last] = dirty_pages(pBlock, lowestFree);
+            if (first == last)
+                return 0;
+
+            const auto page = purge_page_size();
+            if (static_cast<size_t>(last - first) > maxBytes)
+                first = last - ((maxBytes + page - 1) & ~(page - 1));
+
+            if (!system::purge(first, static_cast<size_t>(last - first)))
+                return 0;
+
+            pBlock->dirty_end = first;
+            return static_cast<size_t>(last - first);
+        }
+
+        /// \brief Counts the untouched chunks from the one that holds first up to the end of a block as used, so no
+        /// allocation writes to their pages while they are purged without holding the pool
+        void set_aside_chunks(block *pBlock, const uint8_t *first) noexcept
+        {
+            auto *end = pBlock->block_beginning + static_cast<size_t>(first - pBlock->block_beginning) / chunk_size * chunk_size;
+            if (end >= pBlock->block_end)
+                return;
+
+            const auto count = static_cast<size_t>(pBlock->block_end - end) / chunk_size;
+            pBlock->block_end = end;
+            pBlock->available_chunks -= count;
+            pBlock->used_chunks += count;
+            pBlock->available_space -= count * chunk_size;
+            pBlock->used_space += count * chunk_size;
+
+            if (pBlock->available_chunks == 0)
+                unlink_partial(pBlock);
+        }
+
+        /// \brief Gives back the chunks set aside by set_aside_chunks. The block is retired if it became empty
+        void restore_chunks(block *pBlock)
+        {
+            const auto count = static_cast<size_t>(pBlock->block_beginning + block_size - pBlock->block_end) / chunk_size;
+            if (count == 0)
+                return;
+
+            const bool wasFull = pBlock->available_chunks == 0;
+
+            pBlock->block_end = pBlock->block_beginning + block_size;
+            pBlock->available_chunks += count;
+            pBlock->used_chunks -= count;
+            pBlock->available_space += count * chunk_size;
+            pBlock->used_space -= count * chunk_size;
+
+            if (pBlock->used_chunks == 0 && (pBlock->previous_block != nullptr || pBlock->next_block != nullptr))
             {
-                block *currentBlock = next;
+                // Every chunk was released during the purge, and it is not the only block in the pool
+                if (!wasFull)
+                    unlink_partial(pBlock);
+                unlink_block(pBlock);
+                retire_block(pBlock);
+            }
+            else if (wasFull)
+            {
+                link_partial(pBlock);
+            }
+        }
+
+        /// \brief Sets a bit in released for every chunk of the free list of a block, indexed from its beginning
+        /// \return The number of chunks handed out at some point: the ones below next_untouched_chunk
+        auto mark_released_chunks(const block *pBlock, std::vector<uint64_t> &released) const -> size_t
+        {
+            const auto touched = static_cast<size_t>(pBlock->next_untouched_chunk - pBlock->block_beginning) / chunk_size;
+            released.assign((touched + 63) / 64, 0);
+
+            for (auto *free = pBlock->next_free_chunk; free != nullptr; free = reinterpret_cast<size_t *>(*free))
+            {
+                const auto i = static_cast<size_t>(reinterpret_cast<uint8_t *>(free) - pBlock->block_beginning) / chunk_size;
+                released[i / 64] |= uint64_t { 1 } << (i % 64);
+            }
+
+            return touched;
+        }
+
+        /// \brief Calls f with every chunk in use of a block, in address order
+        template <typename F>
+        void visit_live_chunks(block *pBlock, std::vector<uint64_t> &released, F &f)
+        {
+            if (pBlock->used_chunks == 0)
+                return;
+
+            const auto touched = mark_released_chunks(pBlock, released);
+            for (size_t i = 0; i < touched; ++i)
+            {
+                if ((released[i / 64] & (uint64_t { 1 } << (i % 64))) == 0)
+                    f(reinterpret_cast<T *>(pBlock->block_beginning + i * chunk_size));
+            }
+        }
 
-                // This is the next block
-                next = currentBlock->next_block;
+        /// \brief Makes every chunk of a block available again, without touching them
+        void reset_block(block *pBlock) noexcept
+        {
+            // Every page the block handed out may be resident
+            pBlock->dirty_end = std::max(pBlock->dirty_end, pBlock->next_untouched_chunk);
+
+            pBlock->available_space      = block_size;
+            pBlock->used_space           = 0;
+            pBlock->available_chunks     = block_size / chunk_size;
+            pBlock->used_chunks          = 0;
+            pBlock->next_free_chunk      = nullptr;
+            pBlock->next_untouched_chunk = pBlock->block_beginning;
+            pBlock->next_partial         = nullptr;
+            pBlock->previous_partial     = nullptr;
+        }
+
+        /// \brief Gives the released chunks at the top of a block back to its untouched area, so their pages can be purged.
+        /// The free list is rebuilt in address order, so the lowest chunks are reused first and the top stays unused.
+        /// Never allocates: without purge_scratch_size() words of capacity in released, the block is left as it is
+        void compact_free_chunks(block *pBlock, std::vector<uint64_t> &released)
+        {
+            const auto untouched     = static_cast<size_t>(pBlock->block_end - pBlock->next_untouched_chunk) / chunk_size;
+            const auto releasedCount = pBlock->available_chunks - untouched;
+
+            // Not enough released chunks to free a single page
+            if (releasedCount * chunk_size < purge_page_size() || released.capacity() < purge_scratch_size())
+                return;
 
-                if (freedAddress >= currentBlock->block_beginning && freedAddress <= currentBlock->block_end)
+            const auto touched = mark_released_chunks(pBlock, released);
+
+            auto top = touched;
+            while (top > 0 && (released[(top - 1) / 64] & (uint64_t { 1 } << ((top - 1) % 64))) != 0)
+                --top;
+
+            if (top == touched)
+                return;
+
+            pBlock->dirty_end            = std::max(pBlock->dirty_end, pBlock->next_untouched_chunk);
+            pBlock->next_untouched_chunk = pBlock->block_beginning + top * chunk_size;
+
+            size_t *head = nullptr;
+            for (auto i = top; i-- > 0;)
+            {
+                if ((released[i / 64] & (uint64_t { 1 } << (i % 64))) != 0)
                 {
-                    return currentBlock;
+                    auto *free = reinterpret_cast<size_t *>(pBlock->block_beginning + i * chunk_size);
+                    *free      = reinterpret_cast<size_t>(head);
+                    head       = free;
                 }
             }
+            pBlock->next_free_chunk = head;
+        }
+
+        void link_partial(block *pBlock) noexcept
+        {
+            pBlock->previous_partial = nullptr;
+            pBlock->next_partial     = partial_blocks;
+            if (partial_blocks != nullptr)
+                partial_blocks->previous_partial = pBlock;
+            partial_blocks = pBlock;
+        }
+
+        void unlink_partial(block *pBlock) noexcept
+        {
+            if (pBlock->previous_partial != nullptr)
+                pBlock->previous_partial->next_partial = pBlock->next_partial;
+            else
+                partial_blocks = pBlock->next_partial;
+
+            if (pBlock->next_partial != nullptr)
+                pBlock->next_partial->previous_partial = pBlock->previous_partial;
+
+            pBlock->next_partial     = nullptr;
+            pBlock->previous_partial = nullptr;
+        }
+
+        void unlink_block(block *pBlock) noexcept
+        {
+            if (pBlock->previous_block != nullptr)
+                pBlock->previous_block->next_block = pBlock->next_block;
+            else
+                first_block = pBlock->next_block;
+
+            if (pBlock->next_block != nullptr)
+                pBlock->next_block->previous_block = pBlock->previous_block;
+        }
+
+        block *block_from_pointer(T *ptr)
+        {
+            const auto freedAddress = reinterpret_cast<uintptr_t>(ptr);
+
+            // Reject anything outside the address span of the pool or pointing past the chunks of its window
+            if (freedAddress < lowest_address || freedAddress >= highest_address || (freedAddress & (block_alignment - 1)) >= block_size)
+                throw std::out_of_range("block does not belong to the pool");
+
+            // The span has gaps, and retired blocks may be unmapped, so the page must belong to a block in use before
+            // its block information is read
+            if (pages->find(ptr) != pool_config.page_tag)
+                throw std::out_of_range("block does not belong to the pool");
 
-            throw std::out_of_range("block does not belong to the pool");
+            // Get the block of the current chunk by masking the address with the window alignment
+            return reinterpret_cast<block *>((freedAddress & ~(block_alignment - 1)) + block_info_offset(block_size));
         }
 
     public:
@@ -235,6 +648,7 @@ namespace pool
             // Update chunks
             --used_block->used_chunks;
             ++used_block->available_chunks;
+            ++counters.releases;
 
             // Update size
             used_block->available_space += chunk_size;
@@ -244,69 +658,24 @@ namespace pool
             reporter.dealloc_report(used_block, ptr, chunk_size, used_block->available_space, used_block->available_chunks, used_block->used_space, used_block->used_chunks);
 #endif /*REPORT_ALLOCATIONS*/
 
-            if (used_block->used_chunks == 0)
-            {
-                bool releaseUsedBlock = false;
-                if (used_block->previous_block == nullptr) // This is the first block
-                {
-                    if (used_block->next_block != nullptr) // And we do not have any more block available
-                    {
-                        // So, make the next block the first block
-                        first_block = used_block->next_block;
-                        // Set the first_block previous block nullptr because that previous blocks points to used_block
-                        // And we are going to free this block
-                        first_block->previous_block = nullptr;
-                        releaseUsedBlock            = true;
-                    }
-                }
-                else
-                {
-                    // Update the next_block previous block to point to the previous block of the used block
-                    if (used_block->next_block != nullptr)
-                    {
-                        used_block->previous_block->next_block = used_block->next_block;
-                        used_block->next_block->previous_block = used_block->previous_block;
-                    }
-                    else
-                    {
-                        // Update the previous block -> next_block to zero because this is the one we are freeing
-                        used_block->previous_block->next_block = nullptr;
-                    }
-
-                    releaseUsedBlock = true;
-                }
-
-                if (releaseUsedBlock)
-                {
-                    // Call the destructor before freeing the block
-                    if constexpr (dest && std::is_destructible<T>::value && !std::is_trivially_destructible<T>::value)
-                        ptr->~T();
+            // If the block was full, it is not in the partial list
+            const bool wasFull = used_block->available_chunks == 1;
 
-                    // Do not free the block, we might scramble the available address
-                    // But we are still in O(1) and without any system call when allocating a new chunk
-                    free_block(used_block);
-
-                    // Once freed set the pointer to nullptr
-                    ptr = nullptr;
-                    return; // We don't need the next code
-                }
-            }
-
-            if (used_block->available_chunks == 1)
+            if (used_block->used_chunks == 0 && (used_block->previous_block != nullptr || used_block->next_block != nullptr))
             {
-                // In this situation used_block->next_free_chunk is going to be nullptr
-                // So, we only need to point used_block->next_free_chunk to this freed chunk
-                // and write zero to the address pointed by used_block->next_free_chunk
-                used_block->next_free_chunk  = reinterpret_cast<size_t *>(ptr);
-
-
-                // Call the destructor
+                // The block is empty, and it is not the only block in the pool
+                // Call the destructor before retiring the block
                 if constexpr (dest && std::is_destructible<T>::value && !std::is_trivially_destructible<T>::value)
                     ptr->~T();
 
-                *used_block->next_free_chunk = 0;
-                ptr = nullptr;
+                if (!wasFull)
+                    unlink_partial(used_block);
+                unlink_block(used_block);
+
+                retire_block(used_block);
 
+                // Once freed set the pointer to nullptr
+                ptr = nullptr;
                 return; // We don't need the next code
             }
 
@@ -317,6 +686,7 @@ namespace pool
             // In this situation we must point used_block->next_free_chunk to ptr
             // and write into *ptr the address of used_block->next_free_chunk
             // This way the new used_block->next_free_chunk (*ptr) will point to the previous used_block->next_free_chunk
+            // If the block was full, used_block->next_free_chunk is nullptr, so freed becomes the end of the list
 
             // freed will become the next available chunk
             auto *freed = reinterpret_cast<size_t *>(ptr);
@@ -328,15 +698,133 @@ namespace pool
             // Point the new next available chunk to freed
             used_block->next_free_chunk = freed;
 
+            // The block has available chunks again
+            if (wasFull)
+                link_partial(used_block);
+
             // Once freed set the pointer to nullptr
             ptr = nullptr;
         }
 
+        /// \brief Allocates chunks.size() objects in a single pass, constructing each of them with args
+        /// \param chunks Receives the addresses of the new objects
+        template <typename... Args>
+        void alloc_n(std::span<T *> chunks, const Args &...args)
+        {
+            size_t filled = 0;
+            while (filled < chunks.size())
+            {
+                // The head of the partial list always has available chunks
+                block *current_block = partial_blocks;
+                if (current_block == nullptr)
+                    current_block = allocate_block();
+
+                const size_t count = std::min(chunks.size() - filled, current_block->available_chunks);
+                take_chunks(current_block, chunks.data() + filled, count);
+                filled += count;
+            }
+
+            for (auto *chunk : chunks)
+            {
+                if (pool_config.zero_fill)
+                    memset(chunk, 0, chunk_size);
+
+                if constexpr (!std::is_same<void, T>::value)
+                    new (chunk) T(args...);
+            }
+        }
+
+        /// \brief Releases every object of chunks in a single pass.
+        /// Consecutive objects of the same block are returned together, updating the block once
+        /// \param chunks The objects to release; they are set to nullptr
+        void release_n(std::span<T *> chunks)
+        {
+            size_t i = 0;
+            while (i < chunks.size())
+            {
+                if (chunks[i] == nullptr)
+                {
+                    ++i;
+                    continue;
+                }
+
+                // Get the block of the current chunk
+                block *used_block = block_from_pointer(chunks[i]);
+
+                // If the block was full, it is not in the partial list
+                const bool wasFull = used_block->available_chunks == 0;
+
+                // Push every consecutive chunk of this block into its free list
+                const size_t first = i;
+                for (; i < chunks.size() && chunks[i] != nullptr; ++i)
+                {
+                    auto *address = reinterpret_cast<uint8_t *>(chunks[i]);
+                    if (address < used_block->block_beginning || address >= used_block->block_end)
+                        break;
+
+                    // Call the destructor
+                    if constexpr (dest && std::is_destructible<T>::value && !std::is_trivially_destructible<T>::value)
+                        chunks[i]->~T();
+
+                    auto *freed                 = reinterpret_cast<size_t *>(address);
+                    *freed                      = reinterpret_cast<size_t>(used_block->next_free_chunk);
+                    used_block->next_free_chunk = freed;
+                }
+
+                const size_t count = i - first;
+
+                // Update chunks
+                used_block->used_chunks -= count;
+                used_block->available_chunks += count;
+                counters.releases += count;
+
+                // Update size
+                used_block->available_space += chunk_size * count;
+                used_block->used_space -= chunk_size * count;
+
+#ifdef REPORT_ALLOCATIONS
+                for (size_t n = first; n < i; ++n)
+                    reporter.dealloc_report(used_block, chunks[n], chunk_size, used_block->available_space, used_block->available_chunks, used_block->used_space, used_block->used_chunks);
+#endif /*REPORT_ALLOCATIONS*/
+
+                for (size_t n = first; n < i; ++n)
+                    chunks[n] = nullptr;
+
+                if (used_block->used_chunks == 0 && (used_block->previous_block != nullptr || used_block->next_block != nullptr))
+                {
+                    // The block is empty, and it is not the only block in the pool
+                    if (!wasFull)
+                        unlink_partial(used_block);
+                    unlink_block(used_block);
+
+                    retire_block(used_block);
+                }
+                else if (wasFull)
+                {
+                    // The block has available chunks again
+                    link_partial(used_block);
+                }
+            }
+        }
+
         MP_NODISCARD auto get_chunk_size() const noexcept -> size_t
         {
             return chunk_size;
         }
 
+        /// \brief Alignment of every chunk: the lowest set bit of the chunk size.
+        /// The window of a block is aligned beyond the chunk size, and the chunks are laid out from its beginning
+        MP_NODISCARD auto chunk_alignment() const noexcept -> size_t
+        {
+            return std::min(chunk_size & (~chunk_size + 1), block_alignment);
+        }
+
+        /// \brief Size of the chunk area of the blocks, which may be bigger than the requested one with huge pages
+        MP_NODISCARD auto get_block_size() const noexcept -> size_t
+        {
+            return block_size;
+        }
+
         MP_NODISCARD auto block_count() const noexcept -> size_t
         {
             size_t count = 0;
@@ -351,6 +839,265 @@ namespace pool
             return count;
         }
 
+        /// \brief Number of empty blocks kept by the retention policy
+        MP_NODISCARD auto retained_block_count() const noexcept -> size_t
+        {
+            return retained_count;
+        }
+
+        /// \brief Number of times a retained block was reused instead of allocating a new block
+        MP_NODISCARD auto retained_block_hits() const noexcept -> size_t
+        {
+            return retained_hits;
+        }
+
+        /// \brief Frees the retained blocks that have been kept for longer than the retention time.
+        /// With no retention time, every retained block is freed
+        void trim()
+        {
+            if (pool_config.retention_time.count() > 0)
+                trim_retained_blocks(std::chrono::steady_clock::now());
+            else
+            {
+                while (retained_last != nullptr)
+                    free_block(pop_retained_block());
+            }
+        }
+
+        /// \brief Calls f with every object in use, block by block and in address order inside each block.
+        /// The free list of each block is walked once, so it costs the chunks handed out, not a lookup per object.
+        /// f must not allocate from nor release to the pool
+        template <typename F>
+        void for_each_live(F &&f)
+        {
+            std::vector<uint64_t> released;
+            for (auto *pBlock = first_block; pBlock != nullptr; pBlock = pBlock->next_block)
+                visit_live_chunks(pBlock, released, f);
+        }
+
+        /// \brief Releases every object of the pool at once. The objects are destroyed if the pool destroys them;
+        /// otherwise the blocks are reset without touching their chunks, in O(blocks).
+        /// One block stays in the pool and the others are retired, following the retention options
+        void clear()
+        {
+            std::vector<uint64_t> released;
+
+            if constexpr (dest && !std::is_same<void, T>::value && std::is_destructible<T>::value && !std::is_trivially_destructible<T>::value)
+            {
+                auto destroy = [](T *p) { p->~T(); };
+                for (auto *pBlock = first_block; pBlock != nullptr; pBlock = pBlock->next_block)
+                    visit_live_chunks(pBlock, released, destroy);
+            }
+
+#ifdef REPORT_ALLOCATIONS
+            for (auto *pBlock = first_block; pBlock != nullptr; pBlock = pBlock->next_block)
+            {
+                auto report = [this, pBlock](T *p) {
+                    reporter.dealloc_report(pBlock, p, chunk_size, block_size, block_size / chunk_size, 0, 0);
+                };
+                visit_live_chunks(pBlock, released, report);
+            }
+#endif /*REPORT_ALLOCATIONS*/
+
+            block *next    = first_block;
+            first_block    = nullptr;
+            partial_blocks = nullptr;
+            while (next != nullptr)
+            {
+                block *pBlock = next;
+                next          = pBlock->next_block;
+                reset_block(pBlock);
+
+                if (first_block == nullptr)
+                {
+                    // The first block stays as the only block of the pool
+                    pBlock->previous_block = nullptr;
+                    pBlock->next_block     = nullptr;
+                    first_block            = pBlock;
+                    link_partial(pBlock);
+                }
+                else
+                {
+                    retire_block(pBlock);
+                }
+            }
+
+            counters.releases = counters.allocations;
+        }
+
+        /// \brief Counters of the pool. They are always updated, so this is cheap enough to call in production
+        MP_NODISCARD auto stats() const noexcept -> pool_stats
+        {
+            pool_stats snapshot { counters };
+
+            snapshot.live_chunks     = counters.allocations - counters.releases;
+            snapshot.retained_blocks = retained_count;
+            snapshot.blocks          = counters.block_allocations - counters.block_frees - retained_count;
+            snapshot.reserved_bytes  = (counters.block_allocations - counters.block_frees) * block_memory_size;
+            snapshot.used_bytes      = snapshot.live_chunks * chunk_size;
+
+            return snapshot;
+        }
+
+        /// \brief Returns to the system, up to maxBytes, the pages of the blocks that hold no chunk in use.
+        /// Retained blocks are purged first, the oldest first. The released chunks at the top of each block go back to
+        /// its untouched area, so their pages are purged too; pages below the highest chunk in use are kept.
+        /// The memory stays reserved by the pool and is used again without a system call.
+        /// Reserves its scratch memory before it touches the pool
+        /// \return The number of bytes purged
+        auto purge(size_t maxBytes = std::numeric_limits<size_t>::max()) -> size_t
+        {
+            std::vector<uint64_t> released;
+            released.reserve(purge_scratch_size());
+            return purge(maxBytes, released);
+        }
+
+        /// \brief Like purge, with scratch memory for the compaction of the free lists. Never allocates, so it can run
+        /// while the allocator behind operator new or malloc is locked: blocks are only compacted when released has
+        /// purge_scratch_size() words of capacity
+        /// \return The number of bytes purged
+        auto purge(size_t maxBytes, std::vector<uint64_t> &released) -> size_t
+        {
+            size_t purged = 0;
+
+            for (auto *pBlock = retained_last; pBlock != nullptr && purged < maxBytes; pBlock = pBlock->previous_block)
+                purged += purge_block(pBlock, pBlock->block_beginning, maxBytes - purged);
+
+            for (auto *pBlock = first_block; pBlock != nullptr && purged < maxBytes; pBlock = pBlock->next_block)
+            {
+                compact_free_chunks(pBlock, released);
+                purged += purge_block(pBlock, pBlock->next_untouched_chunk, maxBytes - purged);
+            }
+
+            return purged;
+        }
+
+        /// \brief Capacity of the scratch memory of purge and begin_purge: a bit for every chunk of a block
+        MP_NODISCARD auto purge_scratch_size() const noexcept -> size_t
+        {
+            return (block_size / chunk_size + 63) / 64;
+        }
+
+        /// \brief Pages of a block set aside by begin_purge
+        struct purge_range
+        {
+            block *owner { nullptr };
+            uint8_t *first { nullptr };
+            uint8_t *last { nullptr };
+            bool retained { false }; ///< The block was taken out of the retained list
+            bool purged { false };   ///< Set by purge_pages when the system took the pages
+        };
+
+        /// \brief First step of a purge that doesn't hold the pool during the system calls: sets aside up to maxBytes
+        /// of the pages purge would return, in the same order, until end_purge. Retained blocks leave the retained
+        /// list, and the untouched chunks at the top of the other blocks count as used, so no allocation writes to
+        /// those pages in the meantime and the allocation path doesn't check anything.
+        /// The free lists are compacted here, so the pool must be held
+        /// \param released Scratch memory for the compaction, see purge_scratch_size. Nothing is allocated
+        /// \return The number of ranges filled
+        auto begin_purge(size_t maxBytes, std::span<purge_range> ranges, std::vector<uint64_t> &released) -> size_t
+        {
+            const auto page = purge_page_size();
+            size_t count    = 0;
+            size_t bytes    = 0;
+
+            // The highest pages first, as purge does
+            auto limit = [&](uint8_t *first, uint8_t *last) {
+                if (static_cast<size_t>(last - first) > maxBytes - bytes)
+                    first = last - ((maxBytes - bytes + page - 1) & ~(page - 1));
+                return first;
+            };
+
+            for (auto *pBlock = retained_last; pBlock != nullptr && count < ranges.size() && bytes < maxBytes;)
+            {
+                block *newer       = pBlock->previous_block;
+                auto [first, last] = dirty_pages(pBlock, pBlock->block_beginning);
+                if (first != last)
+                {
+                    first = limit(first, last);
+                    unlink_retained_block(pBlock);
+                    ranges[count++] = { pBlock, first, last, true, false };
+                    bytes += static_cast<size_t>(last - first);
+                }
+                pBlock = newer;
+            }
+
+            for (auto *pBlock = first_block; pBlock != nullptr && count < ranges.size() && bytes < maxBytes; pBlock = pBlock->next_block)
+            {
+                // Already set aside by a purge in progress
+                if (pBlock->block_end != pBlock->block_beginning + block_size)
+                    continue;
+
+                compact_free_chunks(pBlock, released);
+                auto [first, last] = dirty_pages(pBlock, pBlock->next_untouched_chunk);
+                if (first == last)
+                    continue;
+
+                first = limit(first, last);
+                set_aside_chunks(pBlock, first);
+                ranges[count++] = { pBlock, first, last, false, false };
+                bytes += static_cast<size_t>(last - first);
+            }
+
+            return count;
+        }
+
+        /// \brief Second step: returns the pages set aside by begin_purge to the system. It doesn't touch the pool, so
+        /// it runs without holding it
+        /// \return The number of bytes purged
+        static auto purge_pages(std::span<purge_range> ranges) noexcept -> size_t
+        {
+            size_t bytes = 0;
+            for (auto &range : ranges)
+            {
+                const auto size = static_cast<size_t>(range.last - range.first);
+                range.purged    = system::purge(range.first, size);
+                if (range.purged)
+                    bytes += size;
+            }
+            return bytes;
+        }
+
+        /// \brief Last step: gives the blocks of the ranges back to the pool, which must be held again
+        void end_purge(std::span<purge_range> ranges)
+        {
+            // The retained blocks were taken from the oldest, so they go back from the newest
+            for (auto range = ranges.rbegin(); range != ranges.rend(); ++range)
+            {
+                if (range->purged)
+                    range->owner->dirty_end = std::min(range->owner->dirty_end, range->first);
+
+                if (range->retained)
+                    append_retained_block(range->owner);
+                else
+                    restore_chunks(range->owner);
+            }
+
+            // Other blocks may have been retained in the meantime
+            while (retained_count > pool_config.retained_blocks)
+                free_block(pop_retained_block());
+        }
+
+        /// \brief Bytes that purge would return to the system now, not counting the released chunks it would compact
+        MP_NODISCARD auto purgeable_bytes() const noexcept -> size_t
+        {
+            size_t bytes = 0;
+
+            for (auto *pBlock = retained_first; pBlock != nullptr; pBlock = pBlock->next_block)
+            {
+                auto [first, last] = dirty_pages(pBlock, pBlock->block_beginning);
+                bytes += static_cast<size_t>(last - first);
+            }
+
+            for (auto *pBlock = first_block; pBlock != nullptr; pBlock = pBlock->next_block)
+            {
+                auto [first, last] = dirty_pages(pBlock, pBlock->next_untouched_chunk);
+                bytes += static_cast<size_t>(last - first);
+            }
+
+            return bytes;
+        }
+
         MP_NODISCARD auto available_chunks_in_block(T *p)
         {
             return block_from_pointer(p)->available_chunks;
@@ -387,71 +1134,121 @@ namespace pool
         /// is the next free block where the first parameter pointed to
         /// A vector of size zero  corresponds to a fully used block
         /// A vector entry where the first parameter is an address and the second is nullptr corresponds to the end of the list
+        /// The chunks that were never used follow the released chunks, in the order they are going to be handed out
         MP_NODISCARD auto dump_free_list(T *p) -> std::vector<std::pair<T *, T *>>
         {
             auto *block = block_from_pointer(p);
             if (!block->available_chunks)
                 return {};
 
+            std::vector<T *> chunks;
+            chunks.reserve(block->available_chunks);
+
+            for (auto *free = block->next_free_chunk; free != nullptr; free = reinterpret_cast<size_t *>(*free))
+                chunks.emplace_back(reinterpret_cast<T *>(free));
+
+            for (auto *untouched = block->next_untouched_chunk; untouched < block->block_end; untouched += chunk_size)
+                chunks.emplace_back(reinterpret_cast<T *>(untouched));
+
             std::vector<std::pair<T *, T *>> data;
-            data.reserve(block->available_chunks);
+            data.reserve(chunks.size());
 
-            auto *free = block->next_free_chunk;
-            do {
-                auto *next = reinterpret_cast<size_t *>(*free);
-                data.emplace_back(reinterpret_cast<T *>(free), reinterpret_cast<T *>(next));
-                free = next;
-            } while (free != nullptr);
+            for (size_t i = 0; i < chunks.size(); ++i)
+                data.emplace_back(chunks[i], i + 1 < chunks.size() ? chunks[i + 1] : nullptr);
 
             return data;
         }
 
     protected:
-        auto get_available_chunk() -> T *
+        /// \brief Takes count chunks of a block that has at least count available chunks
+        void take_chunks(block *current_block, T **chunks, size_t count)
         {
-            // Get the block of the current chunk
-            block *current_block;
-            block *next = first_block;
-            while (true)
+            // Released chunks first
+            size_t i   = 0;
+            auto *free = current_block->next_free_chunk;
+            for (; i < count && free != nullptr; ++i)
             {
-                current_block = next;
-                if (current_block->available_chunks)
-                {
-                    // In this block we have space, lets use this one!
-                    break;
-                }
+                chunks[i] = reinterpret_cast<T *>(free);
+                free      = reinterpret_cast<size_t *>(*free);
+            }
+            current_block->next_free_chunk = free;
 
-                next = current_block->next_block;
-                if (next == nullptr)
-                {
-                    // Ups! we do not have any more blocks
-                    // Stop the loop because current_block points to the last available block.
-                    // The next condition will handle the creation of a new block
-                    break;
-                }
+            // Then, the chunks that were never used
+            for (; i < count; ++i)
+            {
+                chunks[i] = reinterpret_cast<T *>(current_block->next_untouched_chunk);
+                current_block->next_untouched_chunk += chunk_size;
             }
 
-            if (current_block->available_chunks == 0) // No more chunks
+            // Update chunks
+            current_block->used_chunks += count;
+            current_block->available_chunks -= count;
+            counters.allocations += count;
+
+            // Update size
+            current_block->available_space -= chunk_size * count;
+            current_block->used_space += chunk_size * count;
+
+            // A full block can't serve more allocations
+            if (current_block->available_chunks == 0)
+                unlink_partial(current_block);
+
+#ifdef REPORT_ALLOCATIONS
+            for (i = 0; i < count; ++i)
+                reporter.alloc_report(current_block, chunks[i], chunk_size, current_block->available_space, current_block->available_chunks, current_block->used_space, current_block->used_chunks);
+#endif /*REPORT_ALLOCATIONS*/
+        }
+
+        auto get_available_chunk() -> T *
+        {
+            // The head of the partial list always has available chunks
+            block *current_block = partial_blocks;
+
+            if (current_block == nullptr) // Every block is full
             {
-                // Allocate a new block; allocate_block, will handle for us setting the double-linked list
-                // of the newly created block
-                allocate_block(&current_block->next_block, current_block);
-                current_block = current_block->next_block; // Update the current block
+                // Allocate a new block; allocate_block, will handle for us linking the newly created block
+                current_block = allocate_block();
             }
 
             // Update chunks
             ++current_block->used_chunks;
             --current_block->available_chunks;
+            ++counters.allocations;
 
             // Update size
             current_block->available_space -= chunk_size;
             current_block->used_space += chunk_size;
 
             // Get the available address
-            auto *available = current_block->next_free_chunk;
+            size_t *available;
+            if (current_block->next_free_chunk != nullptr)
+            {
+                // Reuse a released chunk first
+                available = current_block->next_free_chunk;
+
+                // Update current_block->next_free_chunk, so it points to the next available address, which is: *current_block->next_free_chunk
+                current_block->next_free_chunk = reinterpret_cast<size_t *>(*available);
+            }
+            else
+            {
+                // Otherwise, take the next chunk that was never used
+                available = reinterpret_cast<size_t *>(current_block->next_untouched_chunk);
+                current_block->next_untouched_chunk += chunk_size;
 
-            // Update current_block->next_free_chunk, so it points to the next available address, which is: *current_block->next_free_chunk
-            current_block->next_free_chunk = reinterpret_cast<size_t *>(*available);
+#ifdef CHECK_MEMORY_ALIGNMENT
+                if (reinterpret_cast<uint64_t>(available) % sizeof(void *))
+                    throw std::runtime_error("block not aligned"); // Check the free-list alignment
+                if (reinterpret_cast<uint64_t>(available) % (chunk_size & (~chunk_size + 1)))
+                    throw std::runtime_error("block not aligned"); // Check the alignment given by the chunk size
+#endif
+            }
+
+            if (pool_config.zero_fill)
+                memset(available, 0, chunk_size);
+
+            // A full block can't serve more allocations
+            if (current_block->available_chunks == 0)
+                unlink_partial(current_block);
 
 #ifdef REPORT_ALLOCATIONS
             reporter.alloc_report(current_block, available, chunk_size, current_block->available_space, current_block->available_chunks, current_block->used_space, current_block->used_chunks);
@@ -464,6 +1261,23 @@ namespace pool
     private:
         size_t block_size { 0 };
         size_t chunk_size { 0 };
+        size_t block_alignment { 0 };
+        size_t block_memory_size { 0 }; // Chunks and block information
+
+        uintptr_t lowest_address { 0 };
+        uintptr_t highest_address { 0 };
+
+        pool_options pool_config;
+
+        // Pages of the blocks in use, tagged with pool_config.page_tag: pool_config.pages, or own_pages
+        page_map own_pages;
+        page_map *pages { nullptr };
+
+        size_t retained_count { 0 };
+        size_t retained_hits { 0 };
+
+        // Only allocations, releases, block_allocations and block_frees are kept, stats() derives the rest
+        pool_stats counters;
 
 #if defined(REPORT_ALLOCATIONS) || defined(CHECK_MEMORY_LEAK)
         P reporter;
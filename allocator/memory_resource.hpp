@@ -0,0 +1,153 @@
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// Created by Ricardo Romero on 16/10/26.
+// Copyright (c) 2026 Ricardo Romero.  All rights reserved.
+//
+
+#pragma once
+
+#ifndef __cplusplus
+#error "C++ compiler needed"
+#endif /*__cplusplus*/
+
+#ifndef WBSCRP_MEMORY_RESOURCE_HPP
+#define WBSCRP_MEMORY_RESOURCE_HPP
+
+#include "allocator.hpp"
+#include "memory_pool.hpp"
+#include <memory_resource>
+#include <new>
+
+namespace pool
+{
+    /// \brief A std::pmr::memory_resource backed by the size class pools of its own global_allocator.
+    /// Every instance has its own pools and locks, so different subsystems don't share memory or contention
+#if defined(REPORT_ALLOCATIONS) && defined(CHECK_MEMORY_LEAK)
+    template <allocator_reporter R, pool_reporter P>
+#elif !defined(REPORT_ALLOCATIONS) && defined(CHECK_MEMORY_LEAK)
+    template <pool_reporter P>
+#endif
+    struct global_allocator_resource final : public std::pmr::memory_resource
+    {
+#if defined(REPORT_ALLOCATIONS) && defined(CHECK_MEMORY_LEAK)
+        using allocator_type = pool::global_allocator<R, P>;
+#elif !defined(REPORT_ALLOCATIONS) && defined(CHECK_MEMORY_LEAK)
+        using allocator_type = pool::global_allocator<P>;
+#else
+        using allocator_type = pool::global_allocator;
+#endif
+
+        /// \param threadCache Cache chunks per thread. Only worth it when the threads don't alternate between resources
+        explicit global_allocator_resource(bool threadCache = false) :
+            allocator(threadCache)
+        {
+#ifdef REPORT_ALLOCATIONS
+            allocator.reporter().global_new(&allocator);
+#endif /*REPORT_ALLOCATIONS*/
+        }
+
+        MP_NODISCARD auto get_allocator() noexcept -> allocator_type &
+        {
+            return allocator;
+        }
+
+    protected:
+        auto do_allocate(std::size_t bytes, std::size_t alignment) -> void * override
+        {
+#ifdef REPORT_ALLOCATIONS
+            allocator.reporter().alloc_request(bytes);
+#endif /*REPORT_ALLOCATIONS*/
+
+            // Large allocations are only aligned to the page
+            if (alignment > allocator_type::max_alignment)
+                throw std::bad_alloc();
+
+            if (auto *p = allocator.allocate(bytes, alignment); p)
+            {
+                report_granted(allocator, p, bytes);
+                return p;
+            }
+
+            throw std::bad_alloc();
+        }
+
+        auto do_deallocate(void *p, std::size_t bytes, std::size_t alignment) -> void override
+        {
+            report_freed(allocator, p, bytes);
+
+            allocator.deallocate(p, allocator_type::adjust_chunk_size(bytes, alignment));
+        }
+
+        MP_NODISCARD auto do_is_equal(const std::pmr::memory_resource &other) const noexcept -> bool override
+        {
+            // Memory can only be returned to the pools it came from
+            return this == &other;
+        }
+
+    private:
+        allocator_type allocator;
+    };
+
+    /// \brief A std::pmr::memory_resource backed by a single memory_pool.
+    /// Requests that don't fit a chunk are forwarded to the upstream resource. Not thread safe, like the pool
+#if defined(REPORT_ALLOCATIONS) || defined(CHECK_MEMORY_LEAK)
+    template <pool_reporter P>
+#endif
+    struct memory_pool_resource final : public std::pmr::memory_resource
+    {
+#if defined(REPORT_ALLOCATIONS) || defined(CHECK_MEMORY_LEAK)
+        using pool_type = pool::memory_pool<void, P, false>;
+#else
+        using pool_type = pool::memory_pool<void, false>;
+#endif
+
+        memory_pool_resource(std::size_t blockSize, std::size_t chunkSize, pool_options options = {}, std::pmr::memory_resource *upstream = std::pmr::get_default_resource()) :
+            _pool(blockSize, chunkSize, options), _upstream(upstream)
+        {
+        }
+
+        MP_NODISCARD auto get_pool() noexcept -> pool_type &
+        {
+            return _pool;
+        }
+
+        MP_NODISCARD auto upstream_resource() const noexcept -> std::pmr::memory_resource *
+        {
+            return _upstream;
+        }
+
+    protected:
+        auto do_allocate(std::size_t bytes, std::size_t alignment) -> void * override
+        {
+            if (fits_chunk(bytes, alignment))
+                return _pool.alloc();
+
+            return _upstream->allocate(bytes, alignment);
+        }
+
+        auto do_deallocate(void *p, std::size_t bytes, std::size_t alignment) -> void override
+        {
+            if (fits_chunk(bytes, alignment))
+                _pool.release(p);
+            else
+                _upstream->deallocate(p, bytes, alignment);
+        }
+
+        MP_NODISCARD auto do_is_equal(const std::pmr::memory_resource &other) const noexcept -> bool override
+        {
+            return this == &other;
+        }
+
+    private:
+        MP_NODISCARD auto fits_chunk(std::size_t bytes, std::size_t alignment) const noexcept -> bool
+        {
+            return bytes <= _pool.get_chunk_size() && alignment <= _pool.chunk_alignment();
+        }
+
+        pool_type _pool;
+        std::pmr::memory_resource *_upstream;
+    };
+
+} // namespace pool
+
+#endif // WBSCRP_MEMORY_RESOURCE_HPP
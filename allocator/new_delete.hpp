@@ -0,0 +1,291 @@
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// Created by Ricardo Romero on 16/10/26.
+// Copyright (c) 2026 Ricardo Romero.  All rights reserved.
+//
+
+#pragma once
+
+#ifndef __cplusplus
+#error "C++ compiler needed"
+#endif /*__cplusplus*/
+
+#ifndef WBSCRP_NEW_DELETE_HPP
+#define WBSCRP_NEW_DELETE_HPP
+
+// Replaces the global operator new and operator delete of the program with a global_allocator, so every container
+// and every new expression uses the size class pools. The operators are not inline, as the standard requires, so
+// this header must be included in exactly one translation unit of the program.
+//
+// The chunks of the pools are aligned to their size, so they are handed out as they are: the sized delete maps the
+// size the compiler passes to its size class, and the unsized delete finds it in the page map of the allocator.
+// Large allocations, and the ones aligned above max_alignment, are mapped from the system with a 16 bytes header
+// in front that keeps their chunk size.
+
+#include "allocator.hpp"
+#include "pool_reporter.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#if defined(__APPLE__) || defined(__linux__)
+#include <pthread.h>
+#endif /**/
+
+namespace pool::new_delete
+{
+#if defined(REPORT_ALLOCATIONS) && defined(CHECK_MEMORY_LEAK)
+    using allocator_type = pool::global_allocator<allocator_silent_reporter, pool_silent_reporter>;
+#elif !defined(REPORT_ALLOCATIONS) && defined(CHECK_MEMORY_LEAK)
+    using allocator_type = pool::global_allocator<pool_iostream_reporter>;
+#else
+    using allocator_type = pool::global_allocator;
+#endif /*REPORT_ALLOCATIONS*/
+
+    /// \brief Placed right before the memory of a large allocation
+    struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) allocation_header
+    {
+        std::size_t chunk_size { 0 }; // What the chunk was allocated with, for deallocate
+        std::size_t offset { 0 };     // From the beginning of the chunk to the memory handed out
+    };
+
+    inline constexpr std::size_t header_size = sizeof(allocation_header);
+
+    static_assert(header_size == __STDCPP_DEFAULT_NEW_ALIGNMENT__, "the header keeps the chunks aligned to the default new alignment");
+
+    /// \brief The allocator behind operator new. Created on the first allocation and never destroyed, because the
+    /// program may delete memory until its very last destructor
+    inline auto get_allocator() -> allocator_type &
+    {
+#if defined(__clang__) || defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wexit-time-destructors"
+#endif
+        static auto *instance = [] {
+            alignas(allocator_type) static unsigned char storage[sizeof(allocator_type)];
+
+            auto options    = allocator_type::default_block_options;
+            options.backing = block_backing::mapped;
+            auto *allocator = new (storage) allocator_type(true, options);
+
+#if defined(__APPLE__) || defined(__linux__)
+            // The child of fork() must not inherit a size class locked by another thread
+            pthread_atfork([] { get_allocator().lock_all(); }, [] { get_allocator().unlock_all(); }, [] { get_allocator().unlock_all(); });
+#endif /**/
+            return allocator;
+        }();
+#if defined(__clang__) || defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+        return *instance;
+    }
+
+    /// \brief Whether size bytes aligned to alignment are served by a pool, without a header
+    constexpr auto is_pooled(std::size_t size, std::size_t alignment) noexcept -> bool
+    {
+        return alignment <= allocator_type::max_alignment && size <= allocator_type::large_allocation_threshold && allocator_type::adjust_chunk_size(size, alignment) <= allocator_type::large_allocation_threshold;
+    }
+
+    /// \brief Maps size bytes aligned to alignment from the system, with the header in front
+    inline auto allocate_large(std::size_t size, std::size_t alignment) -> void *
+    {
+        // Chunks are aligned to the header, so bigger alignments need room to move the memory forward
+        const auto padding = alignment > header_size ? alignment - header_size : 0;
+        if (size > std::numeric_limits<std::size_t>::max() - header_size - padding - allocator_type::large_allocation_granularity)
+            return nullptr;
+
+        // Small sizes with a big alignment are mapped too, so the memory of a pool never has a header
+        const auto request = std::max(size + header_size + padding, allocator_type::large_allocation_threshold + 1);
+
+        auto *chunk = static_cast<uint8_t *>(get_allocator().allocate(request));
+        if (chunk == nullptr)
+            return nullptr;
+
+        auto *p = chunk + header_size;
+        if (padding > 0)
+            p = reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(p) + alignment - 1) & ~(alignment - 1));
+
+        *reinterpret_cast<allocation_header *>(p - header_size) = { allocator_type::adjust_chunk_size(request), static_cast<std::size_t>(p - chunk) };
+        return p;
+    }
+
+    /// \brief Allocates size bytes aligned to alignment, which must be a power of two
+    /// \return The memory, or nullptr if the system is out of memory
+    inline auto allocate(std::size_t size, std::size_t alignment) noexcept -> void *
+    {
+        try
+        {
+            if (is_pooled(size, alignment))
+                return get_allocator().allocate(size, alignment);
+
+            return allocate_large(size, alignment);
+        }
+        catch (...)
+        {
+            // The pools throw when the system is out of memory
+            return nullptr;
+        }
+    }
+
+    /// \brief Allocates like operator new: calls the new handler until the allocation succeeds, or throws
+    inline auto allocate_or_throw(std::size_t size, std::size_t alignment) -> void *
+    {
+        while (true)
+        {
+            if (void *p = allocate(size, alignment); p != nullptr)
+                return p;
+
+            auto handler = std::get_new_handler();
+            if (handler == nullptr)
+                throw std::bad_alloc();
+            handler();
+        }
+    }
+
+    /// \brief Deallocates memory of any size and alignment. The page map gives the size class of pooled memory,
+    /// and large allocations keep their chunk in the header
+    inline void deallocate(void *p) noexcept
+    {
+        if (p == nullptr)
+            return;
+
+        auto &allocator = get_allocator();
+        if (const auto chunkSize = allocator.pooled_chunk_size(p); chunkSize != 0)
+        {
+            allocator.deallocate(p, chunkSize);
+            return;
+        }
+
+        const auto &header = *reinterpret_cast<const allocation_header *>(static_cast<uint8_t *>(p) - header_size);
+        allocator.deallocate(static_cast<uint8_t *>(p) - header.offset, header.chunk_size);
+    }
+
+    /// \brief Deallocates memory allocated with size and alignment. Pooled memory maps to its size class directly
+    inline void deallocate(void *p, std::size_t size, std::size_t alignment) noexcept
+    {
+        if (p == nullptr)
+            return;
+
+        if (!is_pooled(size, alignment))
+        {
+            deallocate(p);
+            return;
+        }
+
+        get_allocator().deallocate(p, allocator_type::adjust_chunk_size(size, alignment));
+    }
+} // namespace pool::new_delete
+
+#if defined(__clang__) || defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-prototypes"
+#endif
+
+auto operator new(std::size_t size) -> void *
+{
+    return pool::new_delete::allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+auto operator new[](std::size_t size) -> void *
+{
+    return pool::new_delete::allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+auto operator new(std::size_t size, const std::nothrow_t &) noexcept -> void *
+{
+    return pool::new_delete::allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+auto operator new[](std::size_t size, const std::nothrow_t &) noexcept -> void *
+{
+    return pool::new_delete::allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+auto operator new(std::size_t size, std::align_val_t alignment) -> void *
+{
+    return pool::new_delete::allocate_or_throw(size, static_cast<std::size_t>(alignment));
+}
+
+auto operator new[](std::size_t size, std::align_val_t alignment) -> void *
+{
+    return pool::new_delete::allocate_or_throw(size, static_cast<std::size_t>(alignment));
+}
+
+auto operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept -> void *
+{
+    return pool::new_delete::allocate(size, static_cast<std::size_t>(alignment));
+}
+
+auto operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept -> void *
+{
+    return pool::new_delete::allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *p) noexcept
+{
+    pool::new_delete::deallocate(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    pool::new_delete::deallocate(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    pool::new_delete::deallocate(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    pool::new_delete::deallocate(p);
+}
+
+// Sized deallocation: the size maps to the size class, without looking the pointer up
+void operator delete(void *p, std::size_t size) noexcept
+{
+    pool::new_delete::deallocate(p, size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete[](void *p, std::size_t size) noexcept
+{
+    pool::new_delete::deallocate(p, size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    pool::new_delete::deallocate(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+    pool::new_delete::deallocate(p);
+}
+
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    pool::new_delete::deallocate(p);
+}
+
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    pool::new_delete::deallocate(p);
+}
+
+void operator delete(void *p, std::size_t size, std::align_val_t alignment) noexcept
+{
+    pool::new_delete::deallocate(p, size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete[](void *p, std::size_t size, std::align_val_t alignment) noexcept
+{
+    pool::new_delete::deallocate(p, size, static_cast<std::size_t>(alignment));
+}
+
+#if defined(__clang__) || defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif // WBSCRP_NEW_DELETE_HPP
@@ -0,0 +1,153 @@
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// Created by Ricardo Romero on 16/10/26.
+// Copyright (c) 2026 Ricardo Romero.  All rights reserved.
+//
+
+#pragma once
+
+#ifndef __cplusplus
+#error "C++ compiler needed"
+#endif /*__cplusplus*/
+
+#ifndef WBSCRP_PAGE_MAP_HPP
+#define WBSCRP_PAGE_MAP_HPP
+
+#include "system_memory.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if !defined(MP_NODISCARD)
+#if __cplusplus >= 201603L
+#define MP_NODISCARD [[nodiscard]]
+#else
+#define MP_NODISCARD
+#endif
+#endif /*MP_NODISCARD*/
+
+namespace pool
+{
+    /// \brief Tags the pages of the address space with a small number, so the owner of a pointer is found without
+    /// reading the memory around it.
+    /// A two level radix tree: the root and the leaves are mapped from the system on first use and stay until the map
+    /// is destroyed, so lookups never lock. A page is tagged before its memory is handed out and cleared after it is
+    /// given back, so whoever owns an address always finds its tag
+    struct page_map
+    {
+        static constexpr std::size_t page_bits    = 12; // Pages of 4 KiB, whatever the page size of the system
+        static constexpr std::size_t page_size    = std::size_t { 1 } << page_bits;
+        static constexpr std::size_t address_bits = 48;
+        static constexpr std::size_t leaf_bits    = 16; // A leaf tags 256 MiB
+        static constexpr std::size_t root_bits    = address_bits - page_bits - leaf_bits;
+
+        page_map() noexcept = default;
+
+        page_map(const page_map &)            = delete;
+        page_map &operator=(const page_map &) = delete;
+
+        ~page_map()
+        {
+            auto **leaves = root.load(std::memory_order_acquire);
+            if (leaves == nullptr)
+                return;
+
+            for (std::size_t i = 0; i < root_entries; ++i)
+            {
+                if (leaves[i] != nullptr)
+                    system::unmap(leaves[i], leaf_entries);
+            }
+            system::unmap(leaves, root_entries * sizeof(uint8_t *));
+        }
+
+        /// \brief Tags the pages of [address, address + size). A tag of 0 clears them
+        /// \return false if the system is out of memory for the map, or the range is above address_bits. No page is
+        /// tagged then
+        MP_NODISCARD auto assign(const void *address, std::size_t size, uint8_t tag) noexcept -> bool
+        {
+            const auto first = reinterpret_cast<uintptr_t>(address) >> page_bits;
+            const auto last  = (reinterpret_cast<uintptr_t>(address) + std::max<std::size_t>(size, 1) - 1) >> page_bits;
+            if ((last >> (root_bits + leaf_bits)) != 0)
+                return false;
+
+            // Map every leaf first, so a failure leaves the map untouched
+            for (auto leaf = first >> leaf_bits; tag != 0 && leaf <= last >> leaf_bits; ++leaf)
+            {
+                if (leaf_of(leaf, true) == nullptr)
+                    return false;
+            }
+
+            for (auto page = first; page <= last;)
+            {
+                const auto end = std::min(last, page | (leaf_entries - 1));
+                if (auto *leaf = leaf_of(page >> leaf_bits, false); leaf != nullptr)
+                    std::memset(leaf + (page & (leaf_entries - 1)), tag, end - page + 1);
+                page = end + 1;
+            }
+
+            return true;
+        }
+
+        /// \brief Tag of the page of address, or 0 if it has none
+        MP_NODISCARD auto find(const void *address) const noexcept -> uint8_t
+        {
+            const auto page = reinterpret_cast<uintptr_t>(address) >> page_bits;
+            if ((page >> (root_bits + leaf_bits)) != 0)
+                return 0;
+
+            auto **leaves = root.load(std::memory_order_acquire);
+            if (leaves == nullptr)
+                return 0;
+
+            const auto *leaf = std::atomic_ref<uint8_t *>(leaves[page >> leaf_bits]).load(std::memory_order_acquire);
+            return leaf == nullptr ? 0 : leaf[page & (leaf_entries - 1)];
+        }
+
+    private:
+        static constexpr std::size_t root_entries = std::size_t { 1 } << root_bits;
+        static constexpr std::size_t leaf_entries = std::size_t { 1 } << leaf_bits;
+
+        /// \brief Leaf of the index given, mapping it and the root if they don't exist and create is set.
+        /// Threads racing to map the same level keep the first one
+        auto leaf_of(uintptr_t index, bool create) noexcept -> uint8_t *
+        {
+            auto **leaves = root.load(std::memory_order_acquire);
+            if (leaves == nullptr)
+            {
+                if (!create)
+                    return nullptr;
+
+                auto **memory = static_cast<uint8_t **>(system::map(root_entries * sizeof(uint8_t *)));
+                if (memory == nullptr)
+                    return nullptr;
+
+                if (root.compare_exchange_strong(leaves, memory, std::memory_order_acq_rel, std::memory_order_acquire))
+                    leaves = memory;
+                else
+                    system::unmap(memory, root_entries * sizeof(uint8_t *));
+            }
+
+            std::atomic_ref<uint8_t *> slot(leaves[index]);
+            auto *leaf = slot.load(std::memory_order_acquire);
+            if (leaf != nullptr || !create)
+                return leaf;
+
+            auto *memory = static_cast<uint8_t *>(system::map(leaf_entries));
+            if (memory == nullptr)
+                return nullptr;
+
+            if (slot.compare_exchange_strong(leaf, memory, std::memory_order_acq_rel, std::memory_order_acquire))
+                return memory;
+
+            system::unmap(memory, leaf_entries);
+            return leaf;
+        }
+
+        std::atomic<uint8_t **> root { nullptr };
+    };
+
+} // namespace pool
+
+#endif // WBSCRP_PAGE_MAP_HPP
@@ -14,6 +14,7 @@
 #define WBSCRP_POOL_CONCEPT_HPP
 
 #include <concepts>
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
@@ -66,6 +67,15 @@ namespace pool
                                          t.dealloc_request(p, size)
                                      } -> std::same_as<void>;
                                  };
+
+    /// \brief Allocator reporters that also want the address of the memory handed out, like the heap profiler.
+    /// Optional: the allocators only call alloc_granted on the reporters that have it
+    template <typename T>
+    concept granted_memory_reporter = requires(const T t, const void *const p, std::size_t size) {
+                                          {
+                                              t.alloc_granted(p, size)
+                                          } -> std::same_as<void>;
+                                      };
 #elif !defined(REPORT_ALLOCATIONS) && defined CHECK_MEMORY_LEAK
     template <typename T>
     concept pool_reporter = requires(T t, std::size_t b0, uint8_t *p8, const std::vector<std::pair<uint64_t *, uint64_t *>> &pv) {
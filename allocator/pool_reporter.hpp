@@ -103,6 +103,11 @@ namespace pool
             std::cout << "New allocation request: Size: " << std::dec << size << "\n";
         }
 
+        inline static void alloc_granted(const void *const p, std::size_t size) noexcept
+        {
+            std::cout << "Allocation granted. Block: (0x" << std::hex << std::uppercase << reinterpret_cast<std::size_t>(p) << std::dec << "); Size: " << size << "\n";
+        }
+
         inline static void dealloc_request(const void *const p, std::size_t n) noexcept
         {
             std::cout << "Deallocation requested. Block: (0x" << std::hex << std::uppercase << reinterpret_cast<std::size_t>(p) << std::dec << "); Size: " << n << ". \n";
@@ -158,6 +163,30 @@ namespace pool
     {
     };
 #endif /*REPORT_ALLOCATIONS*/
+#if defined(CHECK_MEMORY_LEAK) && defined(REPORT_ALLOCATIONS)
+    /// \brief Allocator reporter that ignores every event
+    struct allocator_silent_reporter
+    {
+        inline static void global_new(void *) noexcept { }
+        inline static void global_freed(void *) noexcept { }
+        inline static void add_ref_count(int64_t) noexcept { }
+        inline static void sub_ref_count(int64_t) noexcept { }
+        inline static void copy_ctor_ref_count(int64_t) noexcept { }
+        inline static void move_ctor_ref_count(int64_t) noexcept { }
+        inline static void alloc_request(std::size_t) noexcept { }
+        inline static void alloc_granted(const void *const, std::size_t) noexcept { }
+        inline static void dealloc_request(const void *const, std::size_t) noexcept { }
+    };
+
+    /// \brief Pool reporter that only reports memory leaks, for allocator reporters that don't need the pool events
+    struct pool_silent_reporter : public pool_reporter_base
+    {
+        inline static void allocate_block(void *, std::size_t, std::size_t) noexcept { }
+        inline static void deallocate_block(void *, std::size_t, std::size_t) noexcept { }
+        inline static void alloc_report(void *, void *, std::size_t, std::size_t, std::size_t, std::size_t, std::size_t) noexcept { }
+        inline static void dealloc_report(void *, void *, std::size_t, std::size_t, std::size_t, std::size_t, std::size_t) noexcept { }
+    };
+#endif /*REPORT_ALLOCATIONS*/
 } // namespace pool
 
 #endif // WBSCRP_REPORTER_HPP
@@ -0,0 +1,107 @@
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// Created by Ricardo Romero on 16/10/26.
+// Copyright (c) 2026 Ricardo Romero.  All rights reserved.
+//
+
+#pragma once
+
+#ifndef __cplusplus
+#error "C++ compiler needed"
+#endif /*__cplusplus*/
+
+#ifndef WBSCRP_SIZE_CLASSES_HPP
+#define WBSCRP_SIZE_CLASSES_HPP
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <limits>
+
+// Number of size classes each doubling of the chunk size is split into
+#ifndef POOL_SIZE_CLASS_STEPS
+#define POOL_SIZE_CLASS_STEPS 4
+#endif /*POOL_SIZE_CLASS_STEPS*/
+
+namespace pool
+{
+    /// \brief Maps allocation sizes to chunk sizes.
+    /// Sizes up to linear_limit are spaced by quantum bytes (16, 32, 48, 64...), and every doubling above it
+    /// is split in Steps classes (160, 192, 224, 256, 320...). Sizes up to 8 bytes use an 8 bytes chunk
+    template <std::size_t Steps>
+    struct size_class_table
+    {
+        static_assert(std::has_single_bit(Steps), "the number of size classes per doubling must be a power of two");
+
+        static constexpr std::size_t min_chunk_size = 8;
+        static constexpr std::size_t quantum        = 16;
+        static constexpr std::size_t linear_limit   = quantum * Steps * 2;
+        static constexpr std::size_t max_chunk_size = std::size_t { 1 } << (std::numeric_limits<std::size_t>::digits - 1);
+
+        static constexpr auto linear_shift = static_cast<std::size_t>(std::bit_width(linear_limit) - 1);
+        static constexpr auto step_shift   = static_cast<std::size_t>(std::bit_width(Steps) - 1);
+
+        static constexpr std::size_t linear_classes = linear_limit / quantum;
+        static constexpr std::size_t count          = 1 + linear_classes + Steps * (std::numeric_limits<std::size_t>::digits - 1 - linear_shift);
+
+        /// \brief Index of the size class that holds size bytes. size must not be greater than max_chunk_size
+        static constexpr auto index(std::size_t size) noexcept -> std::size_t
+        {
+            if (size <= min_chunk_size)
+                return 0;
+            if (size <= linear_limit)
+                return (size + quantum - 1) / quantum;
+
+            // 2^k < size <= 2^(k + 1)
+            const auto k    = static_cast<std::size_t>(std::bit_width(size - 1) - 1);
+            const auto step = (size - 1 - (std::size_t { 1 } << k)) >> (k - step_shift);
+
+            return 1 + linear_classes + (k - linear_shift) * Steps + step;
+        }
+
+        /// \brief Chunk size of a size class
+        static constexpr auto chunk_size(std::size_t index) noexcept -> std::size_t
+        {
+            return sizes[index];
+        }
+
+    private:
+        static constexpr auto make_sizes() noexcept -> std::array<std::size_t, count>
+        {
+            std::array<std::size_t, count> table {};
+
+            std::size_t i = 0;
+            table[i++]    = min_chunk_size;
+
+            for (std::size_t n = 1; n <= linear_classes; ++n)
+                table[i++] = n * quantum;
+
+            for (std::size_t k = linear_shift; k < std::numeric_limits<std::size_t>::digits - 1; ++k)
+            {
+                for (std::size_t n = 1; n <= Steps; ++n)
+                    table[i++] = (std::size_t { 1 } << k) + n * ((std::size_t { 1 } << k) >> step_shift);
+            }
+
+            return table;
+        }
+
+        static constexpr std::array<std::size_t, count> sizes = make_sizes();
+
+        static constexpr auto check_table() noexcept -> bool
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                if (index(sizes[i]) != i || (i > 0 && index(sizes[i - 1] + 1) != i))
+                    return false;
+            }
+            return sizes[count - 1] == max_chunk_size;
+        }
+
+        static_assert(check_table(), "size class table does not map every chunk size to itself");
+    };
+
+    using size_classes = size_class_table<POOL_SIZE_CLASS_STEPS>;
+
+} // namespace pool
+
+#endif // WBSCRP_SIZE_CLASSES_HPP
@@ -0,0 +1,170 @@
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// Created by Ricardo Romero on 16/10/26.
+// Copyright (c) 2026 Ricardo Romero.  All rights reserved.
+//
+
+#pragma once
+
+#ifndef __cplusplus
+#error "C++ compiler needed"
+#endif /*__cplusplus*/
+
+#ifndef WBSCRP_STATIC_POOL_HPP
+#define WBSCRP_STATIC_POOL_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#if !defined(MP_NODISCARD)
+#if __cplusplus >= 201603L
+#define MP_NODISCARD [[nodiscard]]
+#else
+#define MP_NODISCARD
+#endif
+#endif /*MP_NODISCARD*/
+
+namespace pool
+{
+    /// \brief A pool of Capacity objects of type T stored inside the pool itself, so it never allocates.
+    /// The geometry is fixed at compile time: the chunks are sized and aligned for T, and the free list links them
+    /// by index. A static_pool is constant initialized, so a global one is ready before any constructor runs.
+    /// Not thread safe, like memory_pool
+    template <typename T, std::size_t Capacity>
+    struct static_pool
+    {
+        static_assert(!std::is_void_v<T> && std::is_object_v<T>, "static_pool holds objects");
+        static_assert(Capacity > 0, "static_pool needs at least one chunk");
+
+        /// \brief Smallest unsigned type that links every chunk in the free list
+        using index_type = std::conditional_t<Capacity < std::numeric_limits<uint16_t>::max(), uint16_t,
+                                              std::conditional_t<Capacity < std::numeric_limits<uint32_t>::max(), uint32_t, std::size_t>>;
+
+    private:
+        // A chunk holds either an object or the link to the next free chunk
+        union chunk
+        {
+            index_type next_free;
+            alignas(T) unsigned char object[sizeof(T)];
+        };
+
+        // Links are the index of the chunk plus one, so an empty pool is all zeros
+        static constexpr index_type end_of_list = 0;
+
+    public:
+        static constexpr std::size_t capacity        = Capacity;
+        static constexpr std::size_t chunk_size      = sizeof(chunk);
+        static constexpr std::size_t chunk_alignment = alignof(chunk);
+
+        static_assert(chunk_size % alignof(T) == 0, "every chunk must be aligned to T");
+
+        constexpr static_pool() noexcept = default;
+
+        static_pool(const static_pool &)            = delete;
+        static_pool &operator=(const static_pool &) = delete;
+
+        /// \brief Constructs an object with args in a free chunk
+        template <typename... Args>
+        auto alloc(Args &&...args) -> T *
+        {
+            return new (get_available_chunk()) T(std::forward<Args>(args)...);
+        }
+
+        /// \brief Destroys the object and returns its chunk to the pool
+        /// \param ptr The object; it is set to nullptr
+        void release(T *&ptr)
+        {
+            if (ptr == nullptr)
+                return;
+
+            const auto index = index_of(ptr);
+
+            if constexpr (std::is_destructible_v<T> && !std::is_trivially_destructible_v<T>)
+                ptr->~T();
+
+            // The last chunk released is the first one reused, while it is still in the cache
+            chunks[index].next_free = next_free_chunk;
+            next_free_chunk         = static_cast<index_type>(index + 1);
+            --live_chunks;
+
+            ptr = nullptr;
+        }
+
+        /// \brief Whether p points to a chunk of this pool
+        MP_NODISCARD auto contains(const T *p) const noexcept -> bool
+        {
+            const auto address   = reinterpret_cast<uintptr_t>(p);
+            const auto beginning = reinterpret_cast<uintptr_t>(chunks.data());
+            return address >= beginning && address < beginning + sizeof(chunks) && (address - beginning) % chunk_size == 0;
+        }
+
+        /// \brief Objects in use
+        MP_NODISCARD auto size() const noexcept -> std::size_t
+        {
+            return live_chunks;
+        }
+
+        MP_NODISCARD auto available() const noexcept -> std::size_t
+        {
+            return Capacity - live_chunks;
+        }
+
+        MP_NODISCARD auto empty() const noexcept -> bool
+        {
+            return live_chunks == 0;
+        }
+
+        MP_NODISCARD auto full() const noexcept -> bool
+        {
+            return live_chunks == Capacity;
+        }
+
+    private:
+        auto get_available_chunk() -> void *
+        {
+            std::size_t index;
+            if (next_free_chunk != end_of_list)
+            {
+                // Reuse a released chunk first
+                index           = next_free_chunk - 1u;
+                next_free_chunk = chunks[index].next_free;
+            }
+            else if (next_untouched_chunk < Capacity)
+            {
+                // Otherwise, take the next chunk that was never used, so no free list is built up front
+                index = next_untouched_chunk++;
+            }
+            else
+            {
+                throw std::runtime_error("static_pool: out of chunks");
+            }
+
+            ++live_chunks;
+            return chunks[index].object;
+        }
+
+        auto index_of(const T *p) const -> std::size_t
+        {
+            if (!contains(p))
+                throw std::out_of_range("chunk does not belong to the pool");
+
+            return (reinterpret_cast<uintptr_t>(p) - reinterpret_cast<uintptr_t>(chunks.data())) / chunk_size;
+        }
+
+        // Zero initialized, so a static pool is constant initialized and placed in the zero-filled data of the program
+        std::array<chunk, Capacity> chunks {};
+
+        index_type next_free_chunk { end_of_list }; // Chunks released by the user
+        std::size_t next_untouched_chunk { 0 };     // Chunks that were never handed out, up to Capacity
+        std::size_t live_chunks { 0 };
+    };
+
+} // namespace pool
+
+#endif // WBSCRP_STATIC_POOL_HPP
@@ -0,0 +1,176 @@
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// Created by Ricardo Romero on 16/10/26.
+// Copyright (c) 2026 Ricardo Romero.  All rights reserved.
+//
+
+#pragma once
+
+#ifndef __cplusplus
+#error "C++ compiler needed"
+#endif /*__cplusplus*/
+
+#ifndef WBSCRP_SYSTEM_MEMORY_HPP
+#define WBSCRP_SYSTEM_MEMORY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#if defined(__APPLE__) || defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#elif defined(WIN32)
+#include <windows.h>
+#endif /**/
+
+namespace pool::system
+{
+    /// \brief Size of a page of the system
+    inline auto page_size() noexcept -> std::size_t
+    {
+#if defined(__APPLE__) || defined(__linux__)
+        static const auto size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        return size;
+#elif defined(WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return static_cast<std::size_t>(info.dwPageSize);
+#else
+        return 4096;
+#endif
+    }
+
+    /// \brief Maps size bytes of zeroed memory directly from the system
+    /// \return The page aligned address of the memory or nullptr if the system is out of memory
+    inline auto map(std::size_t size) noexcept -> void *
+    {
+#if defined(__APPLE__) || defined(__linux__)
+        void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return memory == MAP_FAILED ? nullptr : memory;
+#elif defined(WIN32)
+        return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+        return std::calloc(1, size);
+#endif
+    }
+
+    /// \brief Returns to the system memory obtained with map
+    inline void unmap(void *memory, [[maybe_unused]] std::size_t size) noexcept
+    {
+#if defined(__APPLE__) || defined(__linux__)
+        munmap(memory, size);
+#elif defined(WIN32)
+        VirtualFree(memory, 0, MEM_RELEASE);
+#else
+        std::free(memory);
+#endif
+    }
+
+    /// \brief Resizes in place memory obtained with map, without moving it. size and newSize must be page aligned
+    /// \return false if the memory can't grow without moving: the pages after it are in use, or the system can't
+    /// resize mappings. The memory is left as it was
+    inline auto remap([[maybe_unused]] void *memory, [[maybe_unused]] std::size_t size, [[maybe_unused]] std::size_t newSize) noexcept -> bool
+    {
+        if (newSize == size)
+            return true;
+
+#if defined(__linux__) && defined(_GNU_SOURCE)
+        // Without MREMAP_MAYMOVE the mapping either grows over the free pages after it or fails
+        return mremap(memory, size, newSize, 0) != MAP_FAILED;
+#elif defined(__APPLE__) || defined(__linux__)
+        // Shrinking only needs to return the tail
+        if (newSize < size)
+            return munmap(static_cast<uint8_t *>(memory) + newSize, size - newSize) == 0;
+        return false;
+#else
+        return false;
+#endif
+    }
+
+    /// \brief Tells the system that the pages in [memory, memory + size) are unused, so it can reclaim them.
+    /// The memory stays mapped and its contents are undefined on the next access. memory and size must be page aligned
+    /// \return false if the system doesn't support it
+    inline auto purge([[maybe_unused]] void *memory, [[maybe_unused]] std::size_t size) noexcept -> bool
+    {
+#if defined(__linux__)
+        // Unlike MADV_FREE, the pages leave the resident set right away
+        return madvise(memory, size, MADV_DONTNEED) == 0;
+#elif defined(__APPLE__)
+        return madvise(memory, size, MADV_FREE) == 0;
+#elif defined(WIN32)
+        return VirtualAlloc(memory, size, MEM_RESET, PAGE_READWRITE) != nullptr;
+#else
+        return false;
+#endif
+    }
+
+    /// \brief Size of the huge pages used to back the blocks
+    inline constexpr std::size_t huge_page_size = 2 << 20;
+
+    /// \brief Maps size bytes aligned to alignment. Both must be multiples of the page size, and alignment a power of two
+    /// \param hugePages Back the memory with huge pages if the system allows it. Otherwise, regular pages are used
+    /// \return The address of the memory or nullptr if the system is out of memory
+    inline auto map_aligned(std::size_t size, std::size_t alignment, [[maybe_unused]] bool hugePages) noexcept -> void *
+    {
+#if defined(__APPLE__) || defined(__linux__)
+        // Map more than needed and trim the unaligned head and the tail
+        auto trim = [size, alignment](void *memory, std::size_t mappedSize) -> void * {
+            const auto address = reinterpret_cast<uintptr_t>(memory);
+            const auto aligned = (address + alignment - 1) & ~(alignment - 1);
+
+            if (aligned > address)
+                munmap(memory, aligned - address);
+            if (address + mappedSize > aligned + size)
+                munmap(reinterpret_cast<void *>(aligned + size), address + mappedSize - aligned - size);
+
+            return reinterpret_cast<void *>(aligned);
+        };
+
+#if defined(MAP_HUGETLB)
+        if (hugePages && size % huge_page_size == 0 && alignment % huge_page_size == 0)
+        {
+            // Explicit huge pages must be reserved by the administrator, so they may not be available.
+            // They are always aligned to the huge page size
+            const auto mappedSize = alignment > huge_page_size ? size + alignment : size;
+            void *memory          = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (memory != MAP_FAILED)
+                return trim(memory, mappedSize);
+        }
+#endif /*MAP_HUGETLB*/
+
+        const auto mappedSize = size + alignment;
+        void *memory          = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            return nullptr;
+
+        void *aligned = trim(memory, mappedSize);
+
+#if defined(MADV_HUGEPAGE)
+        // Ask for transparent huge pages; if they are disabled we just keep the regular pages
+        if (hugePages)
+            madvise(aligned, size, MADV_HUGEPAGE);
+#endif /*MADV_HUGEPAGE*/
+
+        return aligned;
+#elif defined(WIN32)
+        return _aligned_malloc(size, alignment);
+#else
+        return std::aligned_alloc(alignment, size);
+#endif
+    }
+
+    /// \brief Returns to the system memory obtained with map_aligned
+    inline void unmap_aligned(void *memory, [[maybe_unused]] std::size_t size) noexcept
+    {
+#if defined(__APPLE__) || defined(__linux__)
+        munmap(memory, size);
+#elif defined(WIN32)
+        _aligned_free(memory);
+#else
+        std::free(memory);
+#endif
+    }
+
+} // namespace pool::system
+
+#endif // WBSCRP_SYSTEM_MEMORY_HPP
@@ -0,0 +1,288 @@
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// Created by Ricardo Romero on 16/10/26.
+// Copyright (c) 2026 Ricardo Romero.  All rights reserved.
+//
+
+#pragma once
+
+#ifndef __cplusplus
+#error "C++ compiler needed"
+#endif /*__cplusplus*/
+
+#ifndef WBSCRP_TRACE_RECORDER_HPP
+#define WBSCRP_TRACE_RECORDER_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace pool
+{
+    /// \brief An allocation or deallocation read from a trace file
+    struct trace_record
+    {
+        uint64_t timestamp { 0 }; ///< Nanoseconds of a monotonic clock
+        uint64_t address { 0 };   ///< Address in the traced process; pairs an allocation with its deallocation
+        uint64_t size { 0 };
+        uint32_t thread { 0 }; ///< Sequential id of the traced thread
+        bool deallocation { false };
+    };
+
+    /// \brief Allocator reporter that records every allocation and deallocation into a binary trace file.
+    /// Each thread writes its events into its own ring buffer without locks. The rings are written to the file
+    /// when they fill up, on flush() and on close(), so the file is only touched in batches.
+    ///
+    /// File format, in the byte order of the machine: the magic "PLTR" and a version (uint32_t), then chunks of
+    /// events of a single thread: thread id (uint32_t), number of events (uint32_t), and the events. Every event is
+    /// three uint64_t: timestamp in nanoseconds, address, and size, with the highest bit set for deallocations
+    struct trace_recorder
+    {
+        static constexpr std::array<char, 4> magic  = { 'P', 'L', 'T', 'R' };
+        static constexpr uint32_t version           = 1;
+        static constexpr std::size_t ring_capacity  = 4096; // Events per thread
+        static constexpr uint64_t deallocation_flag = uint64_t { 1 } << 63;
+
+        /// \brief Starts recording into path, replacing the file
+        /// \return false if the file can't be created
+        inline static auto open(const char *path) -> bool
+        {
+            close();
+
+            std::unique_lock<std::mutex> lock(file_mutex);
+            file = std::fopen(path, "wb");
+            if (file == nullptr)
+                return false;
+
+            std::fwrite(magic.data(), 1, magic.size(), file);
+            std::fwrite(&version, sizeof(version), 1, file);
+
+            recording.store(true, std::memory_order_release);
+            return true;
+        }
+
+        /// \brief Stops recording, and writes the pending events of every thread
+        inline static void close()
+        {
+            recording.store(false, std::memory_order_release);
+            flush();
+
+            std::unique_lock<std::mutex> lock(file_mutex);
+            if (file != nullptr)
+            {
+                std::fclose(file);
+                file = nullptr;
+            }
+        }
+
+        /// \brief Writes the pending events of every thread to the file
+        inline static void flush()
+        {
+            std::unique_lock<std::mutex> lock(registry_mutex);
+            for (auto *ring = rings; ring != nullptr; ring = ring->next)
+                drain(*ring);
+
+            std::unique_lock<std::mutex> fileLock(file_mutex);
+            if (file != nullptr)
+                std::fflush(file);
+        }
+
+        /// \brief Reads a trace file, with the events of every thread merged by timestamp
+        /// \return The events, or nothing if the file is not a trace
+        inline static auto read(const char *path) -> std::vector<trace_record>
+        {
+            std::vector<trace_record> records;
+
+            std::FILE *in = std::fopen(path, "rb");
+            if (in == nullptr)
+                return records;
+
+            std::array<char, 4> fileMagic {};
+            uint32_t fileVersion = 0;
+            if (std::fread(fileMagic.data(), 1, fileMagic.size(), in) != fileMagic.size() || fileMagic != magic || std::fread(&fileVersion, sizeof(fileVersion), 1, in) != 1 || fileVersion != version)
+            {
+                std::fclose(in);
+                return records;
+            }
+
+            std::array<uint32_t, 2> header {};
+            std::vector<std::array<uint64_t, 3>> events;
+            while (std::fread(header.data(), sizeof(uint32_t), header.size(), in) == header.size())
+            {
+                events.resize(header[1]);
+                if (std::fread(events.data(), sizeof(events[0]), events.size(), in) != events.size())
+                    break;
+
+                for (const auto &[timestamp, address, size] : events)
+                    records.push_back({ timestamp, address, size & ~deallocation_flag, header[0], (size & deallocation_flag) != 0 });
+            }
+            std::fclose(in);
+
+            // Chunks of different threads are interleaved, but the events of a thread are in order
+            std::stable_sort(records.begin(), records.end(), [](const trace_record &a, const trace_record &b) { return a.timestamp < b.timestamp; });
+            return records;
+        }
+
+        // allocator_reporter
+
+        inline static void global_new(void *) noexcept
+        {
+        }
+
+        inline static void global_freed(void *) noexcept
+        {
+        }
+
+        inline static void add_ref_count(int64_t) noexcept
+        {
+        }
+
+        inline static void sub_ref_count(int64_t) noexcept
+        {
+        }
+
+        inline static void copy_ctor_ref_count(int64_t) noexcept
+        {
+        }
+
+        inline static void move_ctor_ref_count(int64_t) noexcept
+        {
+        }
+
+        /// The address is not known yet, so allocations are recorded by alloc_granted
+        inline static void alloc_request(std::size_t) noexcept
+        {
+        }
+
+        inline static void alloc_granted(const void *const p, std::size_t size) noexcept
+        {
+            if (recording.load(std::memory_order_relaxed))
+                push(reinterpret_cast<uintptr_t>(p), size);
+        }
+
+        inline static void dealloc_request(const void *const p, std::size_t size) noexcept
+        {
+            if (recording.load(std::memory_order_relaxed))
+                push(reinterpret_cast<uintptr_t>(p), size | deallocation_flag);
+        }
+
+    private:
+        /// \brief Events of a thread. The thread pushes without locks; drain_mutex serializes the writers of the file
+        struct event_ring
+        {
+            std::array<std::array<uint64_t, 3>, ring_capacity> events {};
+            std::atomic<std::size_t> head { 0 }; // Next event to write to the file
+            std::atomic<std::size_t> tail { 0 }; // Next free slot, only written by the owner thread
+            std::mutex drain_mutex;
+            uint32_t thread { 0 };
+
+            event_ring *next { nullptr };
+            event_ring *previous { nullptr };
+        };
+
+        /// \brief Registers the ring of a thread on its first event and writes it when the thread exits
+        struct thread_ring
+        {
+            thread_ring()
+            {
+                std::unique_lock<std::mutex> lock(registry_mutex);
+                ring         = new event_ring;
+                ring->thread = next_thread++;
+                ring->next   = rings;
+                if (rings != nullptr)
+                    rings->previous = ring;
+                rings = ring;
+            }
+
+            thread_ring(const thread_ring &)            = delete;
+            thread_ring &operator=(const thread_ring &) = delete;
+
+            ~thread_ring()
+            {
+                std::unique_lock<std::mutex> lock(registry_mutex);
+                drain(*ring);
+
+                if (ring->previous != nullptr)
+                    ring->previous->next = ring->next;
+                else
+                    rings = ring->next;
+                if (ring->next != nullptr)
+                    ring->next->previous = ring->previous;
+
+                delete ring;
+            }
+
+            event_ring *ring;
+        };
+
+        static void push(uint64_t address, uint64_t size) noexcept
+        {
+            static thread_local thread_ring local;
+            auto &ring = *local.ring;
+
+            const auto timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+
+            const auto tail = ring.tail.load(std::memory_order_relaxed);
+            if (tail - ring.head.load(std::memory_order_acquire) == ring_capacity)
+                drain(ring); // Full, the thread writes its own events
+
+            ring.events[tail % ring_capacity] = { timestamp, address, size };
+            ring.tail.store(tail + 1, std::memory_order_release);
+        }
+
+        /// \brief Writes the pending events of a ring to the file. Events are discarded if the file is closed
+        static void drain(event_ring &ring) noexcept
+        {
+            std::unique_lock<std::mutex> lock(ring.drain_mutex);
+
+            const auto head = ring.head.load(std::memory_order_relaxed);
+            const auto tail = ring.tail.load(std::memory_order_acquire);
+            if (head == tail)
+                return;
+
+            {
+                std::unique_lock<std::mutex> fileLock(file_mutex);
+                if (file != nullptr)
+                {
+                    const std::array<uint32_t, 2> header = { ring.thread, static_cast<uint32_t>(tail - head) };
+                    std::fwrite(header.data(), sizeof(uint32_t), header.size(), file);
+
+                    // The pending events may wrap around the end of the ring
+                    const auto first = head % ring_capacity;
+                    const auto count = std::min(tail - head, ring_capacity - first);
+                    std::fwrite(ring.events.data() + first, sizeof(ring.events[0]), count, file);
+                    std::fwrite(ring.events.data(), sizeof(ring.events[0]), tail - head - count, file);
+                }
+            }
+
+            ring.head.store(tail, std::memory_order_release);
+        }
+
+#if defined(__clang__) || defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wglobal-constructors"
+#pragma GCC diagnostic ignored "-Wexit-time-destructors"
+#endif
+        inline static std::atomic<bool> recording { false };
+
+        inline static std::mutex file_mutex; // Protects file
+        inline static std::FILE *file { nullptr };
+
+        inline static std::mutex registry_mutex; // Protects rings and next_thread
+        inline static event_ring *rings { nullptr };
+        inline static uint32_t next_thread { 0 };
+#if defined(__clang__) || defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+    };
+
+} // namespace pool
+
+#endif // WBSCRP_TRACE_RECORDER_HPP
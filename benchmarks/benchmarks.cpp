@@ -0,0 +1,612 @@
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// Created by Ricardo Romero on 16/10/26.
+// Copyright (c) 2026 Ricardo Romero.  All rights reserved.
+//
+
+// Benchmark suite of the pool allocators against the system malloc.
+//
+// usage: benchmarks [--format table|csv|json] [--threads N] [--operations N] [--filter text]
+//
+// Every scenario runs with pool_allocator, which uses the global_allocator, and with malloc (or std::allocator for
+// the containers). The csv and json formats are meant to be stored and compared between commits: one row per
+// scenario, allocator and thread count, with the throughput and, for the latency scenario, the percentiles
+
+#include "../allocator/allocator.hpp"
+#include "../allocator/pool_reporter.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined REPORT_ALLOCATIONS && defined CHECK_MEMORY_LEAK
+template <typename T>
+using pool_allocator = pool::pool_allocator<T, pool::allocator_silent_reporter, pool::pool_silent_reporter>;
+#elif !defined(REPORT_ALLOCATIONS) && defined CHECK_MEMORY_LEAK
+template <typename T>
+using pool_allocator = pool::pool_allocator<T, pool::pool_iostream_reporter>;
+#else
+template <typename T>
+using pool_allocator = pool::pool_allocator<T>;
+#endif /*REPORT_ALLOCATIONS*/
+
+namespace
+{
+    using clock_type = std::chrono::steady_clock;
+
+    struct options
+    {
+        enum class output_format
+        {
+            table,
+            csv,
+            json
+        };
+
+        output_format format { output_format::table };
+        unsigned threads { std::max(1u, std::thread::hardware_concurrency()) };
+        std::size_t operations { 2'000'000 };
+        const char *filter { nullptr };
+    };
+
+    struct result
+    {
+        const char *scenario { nullptr };
+        const char *allocator { nullptr };
+        unsigned threads { 1 };
+        std::size_t operations { 0 };
+        double seconds { 0 };
+        double p50 { -1 }; // Nanoseconds; negative when the scenario doesn't measure each operation
+        double p99 { -1 };
+        double p999 { -1 };
+    };
+
+    /// \brief Writes the results as they are produced, in the format of the options
+    struct report
+    {
+        explicit report(options::output_format outputFormat) :
+            format(outputFormat)
+        {
+            if (format == options::output_format::table)
+                std::printf("%-22s %-8s %7s %12s %10s %10s %10s %10s\n", "scenario", "alloc", "threads", "operations", "Mops/s", "p50 ns", "p99 ns", "p99.9 ns");
+            else if (format == options::output_format::csv)
+                std::printf("scenario,allocator,threads,operations,seconds,mops,p50_ns,p99_ns,p999_ns\n");
+            else
+                std::printf("[");
+        }
+
+        report(const report &)            = delete;
+        report &operator=(const report &) = delete;
+
+        ~report()
+        {
+            if (format == options::output_format::json)
+                std::printf("\n]\n");
+        }
+
+        void add(const result &r)
+        {
+            const auto mops = static_cast<double>(r.operations) / r.seconds / 1e6;
+
+            if (format == options::output_format::table)
+            {
+                std::printf("%-22s %-8s %7u %12zu %10.2f", r.scenario, r.allocator, r.threads, r.operations, mops);
+                if (r.p50 >= 0)
+                    std::printf(" %10.0f %10.0f %10.0f", r.p50, r.p99, r.p999);
+                std::printf("\n");
+            }
+            else if (format == options::output_format::csv)
+            {
+                std::printf("%s,%s,%u,%zu,%.6f,%.3f,", r.scenario, r.allocator, r.threads, r.operations, r.seconds, mops);
+                if (r.p50 >= 0)
+                    std::printf("%.0f,%.0f,%.0f\n", r.p50, r.p99, r.p999);
+                else
+                    std::printf(",,\n");
+            }
+            else
+            {
+                std::printf("%s\n  {\"scenario\": \"%s\", \"allocator\": \"%s\", \"threads\": %u, \"operations\": %zu, \"seconds\": %.6f, \"mops\": %.3f",
+                            rows++ == 0 ? "" : ",", r.scenario, r.allocator, r.threads, r.operations, r.seconds, mops);
+                if (r.p50 >= 0)
+                    std::printf(", \"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f", r.p50, r.p99, r.p999);
+                std::printf("}");
+            }
+            std::fflush(stdout);
+        }
+
+    private:
+        options::output_format format;
+        std::size_t rows { 0 };
+    };
+
+    /// \brief Publishes p, so the compiler can't elide a malloc and free pair
+    inline void escape(void *p) noexcept
+    {
+        // An empty asm statement that may read p and any memory, so it costs no instruction
+        asm volatile("" : : "g"(p) : "memory");
+    }
+
+    struct malloc_backend
+    {
+        static constexpr const char *name = "malloc";
+
+        template <typename T>
+        using container_allocator = std::allocator<T>;
+
+        static auto allocate(std::size_t size) -> void *
+        {
+            void *p = std::malloc(size);
+            escape(p);
+            return p;
+        }
+
+        static void deallocate(void *p, std::size_t)
+        {
+            std::free(p);
+        }
+    };
+
+    struct pool_backend
+    {
+        static constexpr const char *name = "pool";
+
+        template <typename T>
+        using container_allocator = pool_allocator<T>;
+
+        auto allocate(std::size_t size) -> void *
+        {
+            void *p = allocator.allocate(size);
+            escape(p);
+            return p;
+        }
+
+        void deallocate(void *p, std::size_t size)
+        {
+            allocator.deallocate(static_cast<char *>(p), size);
+        }
+
+        pool_allocator<char> allocator;
+    };
+
+    /// \brief Sizes of the mixed workloads: mostly small objects, some buffers and a few large allocations
+    auto mixed_size(std::mt19937_64 &random) -> std::size_t
+    {
+        const auto kind = random() % 100;
+        if (kind < 70)
+            return 16 + random() % 112;
+        if (kind < 95)
+            return 128 + random() % 3968;
+        return 4096 + random() % (256 * 1024);
+    }
+
+    /// \brief Runs body on every thread at the same time
+    /// \return The seconds from the start to the end of the last thread
+    template <typename Body>
+    auto run_threads(unsigned threads, Body &&body) -> double
+    {
+        std::atomic<unsigned> ready { 0 };
+        std::atomic<bool> start { false };
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&, t] {
+                ready.fetch_add(1, std::memory_order_relaxed);
+                while (!start.load(std::memory_order_acquire))
+                    std::this_thread::yield();
+                body(t);
+            });
+        }
+
+        while (ready.load(std::memory_order_relaxed) != threads)
+            std::this_thread::yield();
+
+        const auto begin = clock_type::now();
+        start.store(true, std::memory_order_release);
+        for (auto &worker : workers)
+            worker.join();
+
+        return std::chrono::duration<double>(clock_type::now() - begin).count();
+    }
+
+    /// \brief Every thread allocates and frees batches of small objects, without sharing them
+    template <typename Backend>
+    auto thread_scaling(unsigned threads, std::size_t operations) -> result
+    {
+        constexpr std::size_t batch = 64;
+        const auto rounds           = operations / threads / batch / 2;
+
+        const auto seconds = run_threads(threads, [rounds](unsigned t) {
+            Backend backend;
+            std::mt19937_64 random(t);
+            std::array<std::size_t, batch> sizes {};
+            for (auto &size : sizes)
+                size = 16 + random() % 240;
+
+            std::array<void *, batch> pointers {};
+            for (std::size_t r = 0; r < rounds; ++r)
+            {
+                for (std::size_t i = 0; i < batch; ++i)
+                    pointers[i] = backend.allocate(sizes[i]);
+                for (std::size_t i = batch; i-- > 0;)
+                    backend.deallocate(pointers[i], sizes[i]);
+            }
+        });
+
+        return { "thread_scaling", Backend::name, threads, rounds * batch * 2 * threads, seconds };
+    }
+
+    /// \brief Single producer single consumer ring of pointers
+    struct spsc_ring
+    {
+        static constexpr std::size_t capacity = 1024;
+
+        auto push(void *p) -> bool
+        {
+            const auto t = tail.load(std::memory_order_relaxed);
+            if (t - head.load(std::memory_order_acquire) == capacity)
+                return false;
+            slots[t % capacity] = p;
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        auto pop() -> void *
+        {
+            const auto h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire))
+                return nullptr;
+            void *p = slots[h % capacity];
+            head.store(h + 1, std::memory_order_release);
+            return p;
+        }
+
+        std::array<void *, capacity> slots {};
+        alignas(64) std::atomic<std::size_t> head { 0 };
+        alignas(64) std::atomic<std::size_t> tail { 0 };
+    };
+
+    /// \brief Pairs of threads: the producer allocates and the consumer frees, so every chunk changes thread
+    template <typename Backend>
+    auto producer_consumer(unsigned threads, std::size_t operations) -> result
+    {
+        constexpr std::size_t size = 64;
+        const unsigned pairs       = std::max(1u, threads / 2);
+        const auto objects         = operations / pairs / 2;
+
+        std::vector<std::unique_ptr<spsc_ring>> rings;
+        for (unsigned p = 0; p < pairs; ++p)
+            rings.emplace_back(std::make_unique<spsc_ring>());
+
+        const auto seconds = run_threads(pairs * 2, [&rings, objects](unsigned t) {
+            Backend backend;
+            auto &ring = *rings[t / 2];
+            if (t % 2 == 0)
+            {
+                for (std::size_t i = 0; i < objects; ++i)
+                {
+                    void *p = backend.allocate(size);
+                    while (!ring.push(p))
+                        std::this_thread::yield();
+                }
+                return;
+            }
+
+            for (std::size_t i = 0; i < objects;)
+            {
+                if (void *p = ring.pop(); p != nullptr)
+                {
+                    backend.deallocate(p, size);
+                    ++i;
+                }
+                else
+                    std::this_thread::yield();
+            }
+        });
+
+        return { "producer_consumer", Backend::name, pairs * 2, objects * 2 * pairs, seconds };
+    }
+
+    /// \brief Alternates an allocation and a deallocation right at the end of a full block, so a naive pool
+    /// would create and free a block on every pair of operations
+    template <typename Backend>
+    auto block_boundary_churn(std::size_t operations) -> result
+    {
+        constexpr std::size_t size = 256;
+        const auto chunksPerBlock  = pool_allocator<char>::global_allocator::usable_size_from_chunk_size(size) / size;
+
+        Backend backend;
+        std::vector<void *> full;
+        for (std::size_t i = 0; i < chunksPerBlock * 4; ++i)
+            full.emplace_back(backend.allocate(size));
+
+        const auto pairs = operations / 2;
+        const auto begin = clock_type::now();
+        for (std::size_t i = 0; i < pairs; ++i)
+            backend.deallocate(backend.allocate(size), size);
+        const auto seconds = std::chrono::duration<double>(clock_type::now() - begin).count();
+
+        for (auto *p : full)
+            backend.deallocate(p, size);
+
+        return { "block_boundary_churn", Backend::name, 1, pairs * 2, seconds };
+    }
+
+    /// \brief A random working set of mixed sizes, with the events precomputed so the random numbers are not timed
+    struct mixed_workload
+    {
+        struct event
+        {
+            std::size_t slot;
+            std::size_t size;
+        };
+
+        static constexpr std::size_t slots = 8192;
+
+        mixed_workload(std::size_t operations, uint64_t seed)
+        {
+            std::mt19937_64 random(seed);
+            events.reserve(operations);
+            for (std::size_t i = 0; i < operations; ++i)
+                events.push_back({ random() % slots, mixed_size(random) });
+        }
+
+        std::vector<event> events;
+    };
+
+    template <typename Backend>
+    auto mixed_sizes(unsigned threads, std::size_t operations) -> result
+    {
+        std::vector<mixed_workload> workloads;
+        for (unsigned t = 0; t < threads; ++t)
+            workloads.emplace_back(operations / threads, t);
+
+        const auto seconds = run_threads(threads, [&workloads](unsigned t) {
+            Backend backend;
+            std::vector<std::pair<void *, std::size_t>> live(mixed_workload::slots, { nullptr, 0 });
+            for (const auto &[slot, size] : workloads[t].events)
+            {
+                auto &[p, liveSize] = live[slot];
+                if (p != nullptr)
+                {
+                    backend.deallocate(p, liveSize);
+                    p = nullptr;
+                }
+                else
+                {
+                    p        = backend.allocate(size);
+                    liveSize = size;
+                }
+            }
+            for (auto &[p, size] : live)
+            {
+                if (p != nullptr)
+                    backend.deallocate(p, size);
+            }
+        });
+
+        return { "mixed_sizes", Backend::name, threads, operations / threads * threads, seconds };
+    }
+
+    /// \brief The mixed workload on a single thread, timing every operation
+    template <typename Backend>
+    auto latency(std::size_t operations) -> result
+    {
+        const mixed_workload workload(operations, 42);
+        std::vector<double> latencies;
+        latencies.reserve(operations);
+
+        Backend backend;
+        std::vector<std::pair<void *, std::size_t>> live(mixed_workload::slots, { nullptr, 0 });
+        double seconds = 0;
+        for (const auto &[slot, size] : workload.events)
+        {
+            auto &[p, liveSize] = live[slot];
+
+            const auto begin = clock_type::now();
+            if (p != nullptr)
+            {
+                backend.deallocate(p, liveSize);
+                p = nullptr;
+            }
+            else
+            {
+                p        = backend.allocate(size);
+                liveSize = size;
+            }
+            const auto elapsed = std::chrono::duration<double>(clock_type::now() - begin).count();
+
+            seconds += elapsed;
+            latencies.push_back(elapsed * 1e9);
+        }
+        for (auto &[p, size] : live)
+        {
+            if (p != nullptr)
+                backend.deallocate(p, size);
+        }
+
+        // The latencies include the cost of reading the clock, the same for both allocators
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&latencies](double fraction) {
+            return latencies[std::min(latencies.size() - 1, static_cast<std::size_t>(fraction * static_cast<double>(latencies.size())))];
+        };
+
+        return { "latency", Backend::name, 1, latencies.size(), seconds, percentile(0.5), percentile(0.99), percentile(0.999) };
+    }
+
+    template <typename Backend>
+    auto container_map(std::size_t operations) -> result
+    {
+        using map_type = std::map<uint64_t, uint64_t, std::less<>, typename Backend::template container_allocator<std::pair<const uint64_t, uint64_t>>>;
+
+        std::mt19937_64 random(7);
+        std::vector<uint64_t> keys(operations / 2);
+        for (auto &key : keys)
+            key = random();
+
+        const auto begin = clock_type::now();
+        {
+            map_type map;
+            for (auto key : keys)
+                map.emplace(key, key);
+            for (auto key : keys)
+                map.erase(key);
+        }
+        const auto seconds = std::chrono::duration<double>(clock_type::now() - begin).count();
+
+        return { "container_map", Backend::name, 1, keys.size() * 2, seconds };
+    }
+
+    template <typename Backend>
+    auto container_list(std::size_t operations) -> result
+    {
+        using list_type = std::list<uint64_t, typename Backend::template container_allocator<uint64_t>>;
+
+        // Grows and shrinks in waves, so nodes are reused in a different order than allocated
+        constexpr std::size_t wave = 10'000;
+        const auto waves           = std::max<std::size_t>(1, operations / wave / 2);
+
+        const auto begin = clock_type::now();
+        {
+            list_type list;
+            for (std::size_t w = 0; w < waves; ++w)
+            {
+                for (std::size_t i = 0; i < wave; ++i)
+                {
+                    if (i % 2 == 0)
+                        list.push_back(i);
+                    else
+                        list.push_front(i);
+                }
+                for (std::size_t i = 0; i < wave; ++i)
+                    list.pop_front();
+            }
+        }
+        const auto seconds = std::chrono::duration<double>(clock_type::now() - begin).count();
+
+        return { "container_list", Backend::name, 1, waves * wave * 2, seconds };
+    }
+
+    template <typename Backend>
+    auto container_string(std::size_t operations) -> result
+    {
+        using string_type = std::basic_string<char, std::char_traits<char>, typename Backend::template container_allocator<char>>;
+
+        // Appending grows the strings past the small string buffer and reallocates them a few times
+        const auto strings = operations / 8;
+        const auto begin   = clock_type::now();
+        {
+            std::vector<string_type> values;
+            values.reserve(1024);
+            for (std::size_t i = 0; i < strings; ++i)
+            {
+                string_type value("key:");
+                for (std::size_t j = 0; j < 8 + i % 24; ++j)
+                    value += "segment/";
+                values.emplace_back(std::move(value));
+                if (values.size() == 1024)
+                    values.clear();
+            }
+        }
+        const auto seconds = std::chrono::duration<double>(clock_type::now() - begin).count();
+
+        return { "container_string", Backend::name, 1, strings, seconds };
+    }
+
+    auto parse_options(int argc, char *argv[], options &opts) -> bool
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            if (i + 1 == argc)
+                return false;
+
+            const char *value = argv[++i];
+            if (arg == "--format")
+            {
+                if (std::strcmp(value, "table") == 0)
+                    opts.format = options::output_format::table;
+                else if (std::strcmp(value, "csv") == 0)
+                    opts.format = options::output_format::csv;
+                else if (std::strcmp(value, "json") == 0)
+                    opts.format = options::output_format::json;
+                else
+                    return false;
+            }
+            else if (arg == "--threads")
+                opts.threads = static_cast<unsigned>(std::max(1L, std::strtol(value, nullptr, 10)));
+            else if (arg == "--operations")
+                opts.operations = std::max<std::size_t>(1024, std::strtoull(value, nullptr, 10));
+            else if (arg == "--filter")
+                opts.filter = value;
+            else
+                return false;
+        }
+        return true;
+    }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    options opts;
+    if (!parse_options(argc, argv, opts))
+    {
+        std::fprintf(stderr, "usage: %s [--format table|csv|json] [--threads N] [--operations N] [--filter text]\n", argv[0]);
+        return 1;
+    }
+
+    // Keeps the global allocator alive between the scenarios, like in a program that always has allocators around
+    pool_allocator<char> keepAlive;
+
+    // 1, 2, 4... and the maximum
+    std::vector<unsigned> threadCounts;
+    for (unsigned t = 1; t < opts.threads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(opts.threads);
+
+    report out(opts.format);
+    auto run = [&opts, &out](const char *scenario, auto &&benchmark) {
+        if (opts.filter == nullptr || std::strstr(scenario, opts.filter) != nullptr)
+            out.add(benchmark());
+    };
+
+    const auto ops = opts.operations;
+    for (auto threads : threadCounts)
+    {
+        run("thread_scaling", [=] { return thread_scaling<pool_backend>(threads, ops); });
+        run("thread_scaling", [=] { return thread_scaling<malloc_backend>(threads, ops); });
+    }
+    for (auto threads : threadCounts)
+    {
+        if (threads == 1)
+            continue;
+        run("producer_consumer", [=] { return producer_consumer<pool_backend>(threads, ops); });
+        run("producer_consumer", [=] { return producer_consumer<malloc_backend>(threads, ops); });
+    }
+    run("block_boundary_churn", [=] { return block_boundary_churn<pool_backend>(ops); });
+    run("block_boundary_churn", [=] { return block_boundary_churn<malloc_backend>(ops); });
+    for (auto threads : threadCounts)
+    {
+        run("mixed_sizes", [=] { return mixed_sizes<pool_backend>(threads, ops); });
+        run("mixed_sizes", [=] { return mixed_sizes<malloc_backend>(threads, ops); });
+    }
+    run("container_map", [=] { return container_map<pool_backend>(ops); });
+    run("container_map", [=] { return container_map<malloc_backend>(ops); });
+    run("container_list", [=] { return container_list<pool_backend>(ops); });
+    run("container_list", [=] { return container_list<malloc_backend>(ops); });
+    run("container_string", [=] { return container_string<pool_backend>(ops); });
+    run("container_string", [=] { return container_string<malloc_backend>(ops); });
+    run("latency", [=] { return latency<pool_backend>(ops); });
+    run("latency", [=] { return latency<malloc_backend>(ops); });
+
+    return 0;
+}
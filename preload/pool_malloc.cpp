@@ -0,0 +1,451 @@
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// Created by Ricardo Romero on 16/10/26.
+// Copyright (c) 2026 Ricardo Romero.  All rights reserved.
+//
+
+// Replaces the malloc family of the C library with the size classes of a global_allocator, so existing binaries
+// can use the pools without recompiling them:
+//
+//     LD_PRELOAD=/path/to/libpool_malloc.so program
+//
+// free() doesn't know the size of the memory. The chunks of the pools are aligned to their size and handed out as
+// they are, and the page map of the allocator gives the size class of a pointer. Large allocations, the ones
+// aligned above max_alignment and the bootstrap memory have a header right before the returned pointer with their
+// chunk size instead. The pools map their blocks from the system, so the allocator never calls malloc itself;
+// the few allocations made while the allocator is busy (the C library registering the thread cache destructor of
+// every new thread, pthread_atfork) are served from a static arena instead of recursing. The arena reuses what
+// is freed, so programs that keep creating threads don't use it up.
+
+#if defined(REPORT_ALLOCATIONS) || defined(CHECK_MEMORY_LEAK)
+#error "the malloc replacement can't use the reporters, they allocate memory"
+#endif /*REPORT_ALLOCATIONS*/
+
+#include "../allocator/allocator.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <pthread.h>
+#include <unistd.h>
+
+namespace
+{
+    using allocator_type = pool::global_allocator;
+
+    /// \brief Placed right before the memory handed out outside the pools
+    struct alignas(16) allocation_header
+    {
+        std::size_t chunk_size { 0 }; // What the chunk was allocated with, for deallocate
+        std::size_t offset { 0 };     // From the beginning of the chunk to the memory handed out
+    };
+
+    constexpr std::size_t header_size = sizeof(allocation_header);
+
+    // What malloc guarantees: alignof(std::max_align_t)
+    constexpr std::size_t min_alignment = 16;
+
+    static_assert(header_size == min_alignment, "the header keeps the chunks aligned to min_alignment");
+
+    // Memory handed out while the allocator is busy in the same thread, in slots of a power of two size.
+    // Freed slots are kept in a list per size and reused
+    constexpr std::size_t bootstrap_size    = 1 << 20;
+    constexpr std::size_t bootstrap_classes = std::bit_width(bootstrap_size / min_alignment); // 16 bytes to 1 MiB
+    alignas(min_alignment) unsigned char bootstrap_arena[bootstrap_size];
+    std::size_t bootstrap_used { 0 };
+    unsigned char *bootstrap_free[bootstrap_classes] {};
+
+    // Protects the arena. A spin lock, because it is taken inside the allocator and must never allocate
+    std::atomic_flag bootstrap_lock;
+
+    // Depth of malloc calls in this thread. Initial exec, so reading it never allocates
+    __attribute__((tls_model("initial-exec"))) thread_local unsigned reentrancy_depth = 0;
+
+#if defined(__clang__) || defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wglobal-constructors"
+#pragma GCC diagnostic ignored "-Wexit-time-destructors"
+#endif
+    // The allocator is never destroyed: the program may free memory until its very last destructor
+    alignas(allocator_type) unsigned char allocator_storage[sizeof(allocator_type)];
+    std::atomic<allocator_type *> allocator { nullptr };
+    std::mutex allocator_mutex; // Protects the construction of the allocator
+#if defined(__clang__) || defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+    /// \brief Marks the thread as being inside the allocator
+    struct reentrancy_guard
+    {
+        reentrancy_guard() noexcept :
+            reentered(reentrancy_depth++ > 0)
+        {
+        }
+
+        reentrancy_guard(const reentrancy_guard &)            = delete;
+        reentrancy_guard &operator=(const reentrancy_guard &) = delete;
+
+        ~reentrancy_guard()
+        {
+            --reentrancy_depth;
+        }
+
+        const bool reentered;
+    };
+
+    void lock_bootstrap() noexcept
+    {
+        while (bootstrap_lock.test_and_set(std::memory_order_acquire))
+            bootstrap_lock.wait(true, std::memory_order_relaxed);
+    }
+
+    void unlock_bootstrap() noexcept
+    {
+        bootstrap_lock.clear(std::memory_order_release);
+        bootstrap_lock.notify_one();
+    }
+
+    // fork() copies the mutexes as they are, and the threads that locked them don't exist in the child.
+    // The allocator is locked first: the arena is used while holding it
+    void prepare_fork()
+    {
+        if (auto *instance = allocator.load(std::memory_order_acquire); instance != nullptr)
+            instance->lock_all();
+        lock_bootstrap();
+    }
+
+    void after_fork()
+    {
+        unlock_bootstrap();
+        if (auto *instance = allocator.load(std::memory_order_acquire); instance != nullptr)
+            instance->unlock_all();
+    }
+
+    /// \brief The allocator, created on the first call. The thread must hold a reentrancy_guard
+    auto get_allocator() -> allocator_type *
+    {
+        if (auto *instance = allocator.load(std::memory_order_acquire); instance != nullptr)
+            return instance;
+
+        std::unique_lock<std::mutex> lock(allocator_mutex);
+        if (allocator.load(std::memory_order_relaxed) == nullptr)
+        {
+            auto options    = allocator_type::default_block_options;
+            options.backing = pool::block_backing::mapped;
+
+            auto *instance = new (allocator_storage) allocator_type(true, options);
+            pthread_atfork(prepare_fork, after_fork, after_fork);
+            allocator.store(instance, std::memory_order_release);
+        }
+
+        return allocator.load(std::memory_order_relaxed);
+    }
+
+    auto header_of(void *p) noexcept -> allocation_header *
+    {
+        return reinterpret_cast<allocation_header *>(static_cast<unsigned char *>(p) - header_size);
+    }
+
+    auto is_bootstrap(const void *p) noexcept -> bool
+    {
+        return p >= bootstrap_arena && p < bootstrap_arena + bootstrap_size;
+    }
+
+    /// \brief Index of the smallest bootstrap slot that holds size bytes: min_alignment << index
+    auto bootstrap_class(std::size_t size) noexcept -> std::size_t
+    {
+        return size <= min_alignment ? 0 : static_cast<std::size_t>(std::bit_width((size - 1) / min_alignment));
+    }
+
+    auto bootstrap_allocate(std::size_t size, std::size_t alignment) noexcept -> void *
+    {
+        // Slots are aligned to min_alignment, so bigger alignments need room to move the memory forward
+        const auto padding = alignment - min_alignment;
+        if (padding > bootstrap_size - header_size || size > bootstrap_size - header_size - padding)
+            return nullptr;
+
+        const auto index    = bootstrap_class(header_size + padding + size);
+        const auto slotSize = min_alignment << index;
+
+        unsigned char *slot { nullptr };
+        lock_bootstrap();
+        if (bootstrap_free[index] != nullptr)
+        {
+            slot                  = bootstrap_free[index];
+            bootstrap_free[index] = *reinterpret_cast<unsigned char **>(slot);
+        }
+        else if (slotSize <= bootstrap_size - bootstrap_used)
+        {
+            slot = bootstrap_arena + bootstrap_used;
+            bootstrap_used += slotSize;
+        }
+        unlock_bootstrap();
+
+        if (slot == nullptr)
+            return nullptr;
+
+        void *p       = reinterpret_cast<void *>((reinterpret_cast<uintptr_t>(slot) + header_size + alignment - 1) & ~(alignment - 1));
+        *header_of(p) = { slotSize, static_cast<std::size_t>(static_cast<unsigned char *>(p) - slot) };
+        return p;
+    }
+
+    /// \brief Returns a slot of the arena to the list of its size. It may be freed by any thread
+    void bootstrap_deallocate(void *p) noexcept
+    {
+        const auto header = *header_of(p);
+        auto *slot        = static_cast<unsigned char *>(p) - header.offset;
+        const auto index  = bootstrap_class(header.chunk_size);
+
+        lock_bootstrap();
+        *reinterpret_cast<unsigned char **>(slot) = bootstrap_free[index];
+        bootstrap_free[index]                     = slot;
+        unlock_bootstrap();
+    }
+
+    /// \brief Whether size bytes aligned to alignment are served by a pool, without a header
+    constexpr auto is_pooled(std::size_t size, std::size_t alignment) noexcept -> bool
+    {
+        return alignment <= allocator_type::max_alignment && size <= allocator_type::large_allocation_threshold && allocator_type::adjust_chunk_size(size, alignment) <= allocator_type::large_allocation_threshold;
+    }
+
+    /// \brief Chunk size of p if a pool holds it, or 0 if it has a header. Never allocates
+    auto pooled_chunk_size(const void *p) noexcept -> std::size_t
+    {
+        auto *instance = allocator.load(std::memory_order_acquire);
+        return is_bootstrap(p) || instance == nullptr ? 0 : instance->pooled_chunk_size(p);
+    }
+
+    /// \brief Maps size bytes aligned to alignment from the system, with the header in front
+    auto allocate_large(std::size_t size, std::size_t alignment) -> void *
+    {
+        // Chunks are aligned to min_alignment, so bigger alignments need room to move the memory forward
+        const auto padding = alignment - min_alignment;
+
+        // Small sizes with a big alignment are mapped too, so the memory of a pool never has a header
+        const auto request = std::max(size + header_size + padding, allocator_type::large_allocation_threshold + 1);
+
+        auto *chunk = static_cast<unsigned char *>(get_allocator()->allocate(request));
+        if (chunk == nullptr)
+            return nullptr;
+
+        void *p       = reinterpret_cast<void *>((reinterpret_cast<uintptr_t>(chunk) + header_size + alignment - 1) & ~(alignment - 1));
+        *header_of(p) = { allocator_type::adjust_chunk_size(request), static_cast<std::size_t>(static_cast<unsigned char *>(p) - chunk) };
+        return p;
+    }
+
+    /// \brief Allocates size bytes aligned to alignment, which must be a power of two
+    auto allocate(std::size_t size, std::size_t alignment) noexcept -> void *
+    {
+        alignment = std::max(alignment, min_alignment);
+
+        // Room for the header and for moving the memory forward, in case it is mapped
+        if (size > std::numeric_limits<std::size_t>::max() - header_size - alignment - allocator_type::large_allocation_granularity)
+        {
+            errno = ENOMEM;
+            return nullptr;
+        }
+
+        reentrancy_guard guard;
+
+        void *p { nullptr };
+        if (guard.reentered)
+        {
+            p = bootstrap_allocate(size, alignment);
+        }
+        else
+        {
+            try
+            {
+                p = is_pooled(size, alignment) ? get_allocator()->allocate(size, alignment) : allocate_large(size, alignment);
+            }
+            catch (...)
+            {
+                // The pools throw when the system is out of memory
+            }
+        }
+
+        if (p == nullptr)
+            errno = ENOMEM;
+        return p;
+    }
+
+    void deallocate(void *p) noexcept
+    {
+        if (p == nullptr)
+            return;
+
+        if (is_bootstrap(p))
+        {
+            bootstrap_deallocate(p);
+            return;
+        }
+
+        reentrancy_guard guard;
+
+        if (const auto chunkSize = pooled_chunk_size(p); chunkSize != 0)
+        {
+            get_allocator()->deallocate(p, chunkSize);
+            return;
+        }
+
+        const auto header = *header_of(p);
+        get_allocator()->deallocate(static_cast<unsigned char *>(p) - header.offset, header.chunk_size);
+    }
+
+    /// \brief Resizes a large allocation in place so it holds size bytes after the header. Pooled chunks keep their
+    /// size class
+    auto resize(void *p, std::size_t size) noexcept -> bool
+    {
+        if (pooled_chunk_size(p) != 0)
+            return false;
+
+        auto *header = header_of(p);
+        if (size > std::numeric_limits<std::size_t>::max() - header->offset - allocator_type::large_allocation_granularity)
+            return false;
+
+        reentrancy_guard guard;
+
+        const auto request = size + header->offset;
+        if (!get_allocator()->try_expand(static_cast<unsigned char *>(p) - header->offset, header->chunk_size, request))
+            return false;
+
+        header->chunk_size = allocator_type::adjust_chunk_size(request);
+        return true;
+    }
+
+    auto usable_size(void *p) noexcept -> std::size_t
+    {
+        if (const auto chunkSize = pooled_chunk_size(p); chunkSize != 0)
+            return chunkSize;
+
+        const auto *header = header_of(p);
+        return header->chunk_size - header->offset;
+    }
+
+    /// \brief Whether the memory of p is known to be zero. Memory with a header outside the arena is mapped just for
+    /// it; the slots of the arena are reused
+    auto is_zeroed(void *p) noexcept -> bool
+    {
+        return !is_bootstrap(p) && pooled_chunk_size(p) == 0;
+    }
+
+    auto is_valid_alignment(std::size_t alignment) noexcept -> bool
+    {
+        return alignment != 0 && (alignment & (alignment - 1)) == 0;
+    }
+} // namespace
+
+extern "C"
+{
+    __attribute__((visibility("default"))) void *malloc(std::size_t size) noexcept
+    {
+        return allocate(size, min_alignment);
+    }
+
+    __attribute__((visibility("default"))) void free(void *p) noexcept
+    {
+        deallocate(p);
+    }
+
+    __attribute__((visibility("default"))) void *calloc(std::size_t count, std::size_t size) noexcept
+    {
+        if (size != 0 && count > std::numeric_limits<std::size_t>::max() / size)
+        {
+            errno = ENOMEM;
+            return nullptr;
+        }
+
+        void *p = allocate(count * size, min_alignment);
+        if (p != nullptr && !is_zeroed(p))
+            std::memset(p, 0, count * size);
+        return p;
+    }
+
+    __attribute__((visibility("default"))) void *realloc(void *p, std::size_t size) noexcept
+    {
+        if (p == nullptr)
+            return allocate(size, min_alignment);
+
+        // Like the C library, realloc(p, 0) frees p
+        if (size == 0)
+        {
+            deallocate(p);
+            return nullptr;
+        }
+
+        // Keep the chunk if it still fits and isn't mostly wasted
+        const auto available = usable_size(p);
+        if (size <= available && (size >= available / 2 || is_bootstrap(p)))
+            return p;
+
+        // Large allocations grow over the free pages after them, and shrink, without copying
+        if (!is_bootstrap(p) && resize(p, size))
+            return p;
+
+        void *q = allocate(size, min_alignment);
+        if (q == nullptr)
+            return nullptr;
+
+        std::memcpy(q, p, std::min(size, available));
+        deallocate(p);
+        return q;
+    }
+
+    __attribute__((visibility("default"))) int posix_memalign(void **memptr, std::size_t alignment, std::size_t size) noexcept
+    {
+        if (!is_valid_alignment(alignment) || alignment % sizeof(void *) != 0)
+            return EINVAL;
+
+        void *p = allocate(size, alignment);
+        if (p == nullptr)
+            return ENOMEM;
+
+        *memptr = p;
+        return 0;
+    }
+
+    __attribute__((visibility("default"))) void *aligned_alloc(std::size_t alignment, std::size_t size) noexcept
+    {
+        if (!is_valid_alignment(alignment))
+        {
+            errno = EINVAL;
+            return nullptr;
+        }
+
+        return allocate(size, alignment);
+    }
+
+    __attribute__((visibility("default"))) void *memalign(std::size_t alignment, std::size_t size) noexcept
+    {
+        return aligned_alloc(alignment, size);
+    }
+
+    __attribute__((visibility("default"))) void *valloc(std::size_t size) noexcept
+    {
+        return allocate(size, pool::system::page_size());
+    }
+
+    __attribute__((visibility("default"))) void *pvalloc(std::size_t size) noexcept
+    {
+        const auto pageSize = pool::system::page_size();
+        if (size > std::numeric_limits<std::size_t>::max() - pageSize)
+        {
+            errno = ENOMEM;
+            return nullptr;
+        }
+
+        return allocate((size + pageSize - 1) & ~(pageSize - 1), pageSize);
+    }
+
+    __attribute__((visibility("default"))) std::size_t malloc_usable_size(void *p) noexcept
+    {
+        return p == nullptr ? 0 : usable_size(p);
+    }
+}
@@ -0,0 +1,146 @@
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// Created by Ricardo Romero on 16/10/26.
+// Copyright (c) 2026 Ricardo Romero.  All rights reserved.
+//
+
+// Replaces operator new and delete of the whole program, so it is built as its own test executable
+
+#include "../allocator/new_delete.hpp"
+#include <catch2/catch_test_macros.hpp>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+    auto live_chunks(std::size_t size) -> std::size_t
+    {
+        const auto chunkSize = pool::new_delete::allocator_type::adjust_chunk_size(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+        auto &allocator      = pool::new_delete::get_allocator();
+        allocator.collect_remote_frees();
+        return allocator.stats().size_classes[pool::size_classes::index(chunkSize)].live_chunks;
+    }
+} // namespace
+
+TEST_CASE("Global operator new and delete")
+{
+    SECTION("new expressions use the pools")
+    {
+        struct object
+        {
+            std::array<uint8_t, 200> data {};
+        };
+
+        const auto before = live_chunks(sizeof(object));
+        std::vector<std::unique_ptr<object>> objects;
+        objects.reserve(100);
+        for (size_t i = 0; i < 100; ++i)
+            objects.emplace_back(std::make_unique<object>());
+        CHECK(live_chunks(sizeof(object)) == before + 100);
+
+        // unique_ptr deletes with the sized operator delete
+        objects.clear();
+        CHECK(live_chunks(sizeof(object)) == before);
+    }
+
+    SECTION("Sized, unsized and array deletes")
+    {
+        auto *p = static_cast<uint8_t *>(::operator new(100));
+        auto *q = static_cast<uint8_t *>(::operator new(100));
+        auto *a = new uint64_t[1000];
+        CHECK(reinterpret_cast<uintptr_t>(p) % __STDCPP_DEFAULT_NEW_ALIGNMENT__ == 0);
+
+        ::operator delete(p, 100);
+        ::operator delete(q);
+        delete[] a;
+
+        // Pooled memory has no header: a 64 bytes allocation takes a whole 64 bytes chunk, and the unsized delete
+        // finds its size class
+        const auto before = live_chunks(64);
+        auto *chunk       = static_cast<uint8_t *>(::operator new(64));
+        CHECK(live_chunks(64) == before + 1);
+        CHECK(pool::new_delete::get_allocator().pooled_chunk_size(chunk) == 64);
+        CHECK(reinterpret_cast<uintptr_t>(chunk) % 64 == 0);
+        ::operator delete(chunk);
+        CHECK(live_chunks(64) == before);
+
+        // Large allocations are mapped directly, with the header too
+        auto *large = static_cast<uint8_t *>(::operator new(1 << 20));
+        large[(1 << 20) - 1] = 1;
+        ::operator delete(large, 1 << 20);
+    }
+
+    SECTION("Over-aligned allocations")
+    {
+        struct alignas(256) aligned_object
+        {
+            uint64_t value { 0 };
+        };
+
+        std::vector<aligned_object *> objects;
+        for (uint64_t i = 0; i < 100; ++i)
+        {
+            objects.emplace_back(new aligned_object { i });
+            CHECK(reinterpret_cast<uintptr_t>(objects.back()) % 256 == 0);
+        }
+        for (uint64_t i = 0; i < 100; ++i)
+        {
+            CHECK(objects[i]->value == i);
+            delete objects[i];
+        }
+
+        void *page = ::operator new(300000, std::align_val_t { 8192 });
+        CHECK(reinterpret_cast<uintptr_t>(page) % 8192 == 0);
+        ::operator delete(page, 300000, std::align_val_t { 8192 });
+
+        // Small sizes aligned above max_alignment are mapped with the header, and any delete finds it
+        void *small = ::operator new(100, std::align_val_t { 16384 });
+        CHECK(reinterpret_cast<uintptr_t>(small) % 16384 == 0);
+        CHECK(pool::new_delete::get_allocator().pooled_chunk_size(small) == 0);
+        ::operator delete(small, 100, std::align_val_t { 16384 });
+        ::operator delete(::operator new(100, std::align_val_t { 16384 }), std::align_val_t { 16384 });
+    }
+
+    SECTION("Containers")
+    {
+        std::map<int, std::string> map;
+        for (int i = 0; i < 10000; ++i)
+            map.emplace(i, std::string(static_cast<size_t>(i % 100), 'x'));
+        for (int i = 0; i < 10000; i += 2)
+            map.erase(i);
+
+        CHECK(map.size() == 5000);
+        CHECK(map[99] == std::string(99, 'x'));
+    }
+
+    SECTION("Purging after deletes")
+    {
+        // The purge compacts the free lists with scratch memory, which must not come from operator new while a size
+        // class is locked
+        std::vector<uint8_t *> objects;
+        objects.reserve(1000);
+        for (size_t i = 0; i < 1000; ++i)
+            objects.emplace_back(new uint8_t[128]);
+        for (size_t i = 100; i < objects.size(); ++i)
+            delete[] objects[i];
+        objects.resize(100);
+
+        auto &allocator = pool::new_delete::get_allocator();
+        allocator.release_thread_caches();
+        CHECK(allocator.purge() > 0);
+
+        for (auto *object : objects)
+            delete[] object;
+    }
+
+    SECTION("Out of memory")
+    {
+        CHECK(::operator new(std::numeric_limits<size_t>::max() - 8, std::nothrow) == nullptr);
+        CHECK_THROWS_AS(::operator new(std::numeric_limits<size_t>::max() - 8), std::bad_alloc);
+    }
+}
@@ -7,14 +7,31 @@
 
 
 #include "../allocator/allocator.hpp"
+#include "../allocator/bitmap_pool.hpp"
+#include "../allocator/heap_profiler.hpp"
+#include "../allocator/memory_resource.hpp"
 #include "../allocator/pool_concept.hpp"
 #include "../allocator/pool_reporter.hpp"
+#include "../allocator/static_pool.hpp"
+#include "../allocator/trace_recorder.hpp"
 #include <catch2/benchmark/catch_benchmark_all.hpp>
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers_string.hpp>
+#include <atomic>
+#include <filesystem>
 #include <iostream>
+#include <list>
+#include <memory_resource>
 #include <random>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
 #include <vector>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif /*__linux__*/
 
 
 TEST_CASE("Initialize Memory pool", "")
@@ -41,6 +58,52 @@ TEST_CASE("Memory free inside block")
     delete i0;
 }
 
+TEST_CASE("Block lookup from pointer")
+{
+    using namespace Catch::Matchers;
+    pool::memory_pool<uint64_t> pool(4096, 8);
+
+    std::vector<uint64_t *> p64;
+    for (uint64_t a = 0; a < 512 * 8; ++a)
+        p64.emplace_back(pool.alloc(a));
+    REQUIRE(pool.block_count() == 8);
+
+    // Every pointer must map to its own block, regardless of the number of blocks
+    for (size_t i = 0; i < p64.size(); ++i)
+    {
+        REQUIRE(pool.block_address(p64[i]) == reinterpret_cast<uint8_t *>(p64[i - (i % 512)]));
+        REQUIRE(pool.used_chunks_in_block(p64[i]) == 512);
+    }
+
+    // A pointer one past the end of the block does not belong to the block
+    auto *pastTheEnd = reinterpret_cast<uint64_t *>(pool.block_address(nullptr) + 4096);
+    CHECK_THROWS_WITH(pool.used_chunks_in_block(pastTheEnd), ContainsSubstring("does not belong"));
+
+    for (auto &p : p64)
+        pool.release(p);
+
+    // A pointer into a freed block is rejected without reading the block, which is no longer mapped
+    pool::memory_pool<uint64_t> mapped(4096, 8, pool::pool_options { .retained_blocks = 0, .backing = pool::block_backing::mapped });
+    std::vector<uint64_t *> first;
+    std::vector<uint64_t *> second;
+    for (uint64_t a = 0; a < 512; ++a)
+        first.emplace_back(mapped.alloc(a));
+    for (uint64_t a = 0; a < 512; ++a)
+        second.emplace_back(mapped.alloc(a));
+    REQUIRE(mapped.block_count() == 2);
+
+    auto *stale = second[7];
+    for (auto &p : second)
+        mapped.release(p);
+    REQUIRE(mapped.block_count() == 1);
+
+    CHECK_THROWS_WITH(mapped.release(stale), ContainsSubstring("does not belong"));
+    CHECK_THROWS_WITH(mapped.used_chunks_in_block(stale), ContainsSubstring("does not belong"));
+
+    for (auto &p : first)
+        mapped.release(p);
+}
+
 TEST_CASE("Memory data integrity and release")
 {
     pool::memory_pool<int> pool(4096, 8);
@@ -298,6 +361,416 @@ TEST_CASE("Free list integrity")
     }
 }
 
+TEST_CASE("Released chunks are reused before untouched chunks")
+{
+    pool::memory_pool<uint64_t> pool(4096, 8);
+
+    uint64_t *p0 = pool.alloc(0ull);
+    uint64_t *p1 = pool.alloc(1ull);
+    uint64_t *p2 = pool.alloc(2ull);
+    CHECK(p1 == p0 + 1);
+    CHECK(p2 == p1 + 1);
+
+    auto *released = p1;
+    pool.release(released);
+
+    auto freeList = pool.dump_free_list(p0);
+    REQUIRE(freeList.size() == 512 - 2);
+    CHECK(freeList[0].first == p1);
+    CHECK(freeList[0].second == p2 + 1);
+    CHECK(freeList[1].first == p2 + 1);
+    CHECK(freeList.back().second == nullptr);
+
+    CHECK(pool.alloc(1ull) == p1);
+    CHECK(pool.alloc(3ull) == p2 + 1);
+}
+
+TEST_CASE("Zero filled chunks")
+{
+    // A void pool does not construct anything in the chunks
+    pool::memory_pool<void, false> pool(4096, 8, pool::pool_options { .zero_fill = true });
+
+    auto *p0 = static_cast<uint64_t *>(pool.alloc());
+    auto *p1 = static_cast<uint64_t *>(pool.alloc());
+    CHECK(*p0 == 0);
+    CHECK(*p1 == 0);
+    *p0 = 0xddffbbccddffbbccull;
+    *p1 = 0xaaffbbccddffbbccull;
+
+    // Once released, p1 holds the address of p0 in the free list
+    void *released = p0;
+    pool.release(released);
+    released = p1;
+    pool.release(released);
+
+    auto *p2 = static_cast<uint64_t *>(pool.alloc());
+    REQUIRE(p2 == p1);
+    CHECK(*p2 == 0);
+
+    released = p2;
+    pool.release(released);
+}
+
+TEST_CASE("Empty block retention")
+{
+    auto oscillate = [](auto &pool) {
+        std::vector<uint64_t *> p64;
+        for (uint64_t a = 0; a < 512; ++a)
+            p64.emplace_back(pool.alloc(a));
+
+        // Cross the block boundary back and forth
+        for (int i = 0; i < 8; ++i)
+        {
+            uint64_t *extra = pool.alloc(0ull);
+            REQUIRE(pool.block_count() == 2);
+            pool.release(extra);
+            REQUIRE(pool.block_count() == 1);
+        }
+
+        for (auto &p : p64)
+            pool.release(p);
+    };
+
+    SECTION("Retained blocks are reused")
+    {
+        pool::memory_pool<uint64_t> pool(4096, 8, pool::pool_options { .retained_blocks = 1 });
+        oscillate(pool);
+        CHECK(pool.retained_block_count() == 1);
+        CHECK(pool.retained_block_hits() == 7);
+
+        pool.trim();
+        CHECK(pool.retained_block_count() == 0);
+    }
+
+    SECTION("No retention by default")
+    {
+        pool::memory_pool<uint64_t> pool(4096, 8);
+        oscillate(pool);
+        CHECK(pool.retained_block_count() == 0);
+        CHECK(pool.retained_block_hits() == 0);
+    }
+
+    SECTION("Retention time")
+    {
+        pool::memory_pool<uint64_t> pool(4096, 8, pool::pool_options { .retained_blocks = 4, .retention_time = std::chrono::milliseconds(1) });
+        oscillate(pool);
+        CHECK(pool.retained_block_count() == 1);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        pool.trim();
+        CHECK(pool.retained_block_count() == 0);
+    }
+}
+
+TEST_CASE("Bulk reset and live iteration")
+{
+    SECTION("Live objects are visited and the pool is reset")
+    {
+        pool::memory_pool<uint64_t> pool(4096, 8, pool::pool_options { .retained_blocks = 2 });
+
+        std::vector<uint64_t *> p64;
+        for (uint64_t a = 0; a < 2000; ++a)
+            p64.emplace_back(pool.alloc(a));
+        REQUIRE(pool.block_count() == 4);
+
+        // Leave only the multiples of three
+        for (uint64_t a = 0; a < 2000; ++a)
+        {
+            if (a % 3)
+                pool.release(p64[a]);
+        }
+
+        size_t live = 0;
+        uint64_t sum = 0;
+        pool.for_each_live([&](uint64_t *p) {
+            REQUIRE(*p % 3 == 0);
+            ++live;
+            sum += *p;
+        });
+        CHECK(live == 667);
+        CHECK(sum == 3 * 666 * 667 / 2);
+
+        pool.clear();
+        CHECK(pool.block_count() == 1);
+        CHECK(pool.retained_block_count() == 2);
+        CHECK(pool.stats().live_chunks == 0);
+
+        live = 0;
+        pool.for_each_live([&live](uint64_t *) { ++live; });
+        CHECK(live == 0);
+
+        // The pool serves allocations again from the beginning of its blocks
+        for (uint64_t a = 0; a < 2000; ++a)
+            p64[a] = pool.alloc(a);
+        CHECK(pool.block_count() == 4);
+        CHECK(pool.retained_block_hits() == 2);
+        for (uint64_t a = 0; a < 2000; ++a)
+            REQUIRE(*p64[a] == a);
+
+        for (auto &p : p64)
+            pool.release(p);
+        CHECK(pool.stats().live_chunks == 0);
+    }
+
+    SECTION("Live objects are destroyed")
+    {
+        struct tracked
+        {
+            tracked(size_t *counter) :
+                destroyed { counter }
+            {
+            }
+
+            ~tracked()
+            {
+                ++*destroyed;
+            }
+
+            size_t *destroyed;
+        };
+
+        size_t destroyed = 0;
+        {
+            pool::memory_pool<tracked> pool(4096, sizeof(tracked));
+            std::vector<tracked *> objects;
+            for (size_t i = 0; i < 1000; ++i)
+                objects.emplace_back(pool.alloc(&destroyed));
+            for (size_t i = 0; i < 1000; i += 2)
+                pool.release(objects[i]);
+            REQUIRE(destroyed == 500);
+
+            pool.clear();
+            CHECK(destroyed == 1000);
+            CHECK(pool.stats().releases == 1000);
+        }
+        CHECK(destroyed == 1000);
+
+        // Without destructors, the chunks are not touched
+        destroyed = 0;
+        pool::memory_pool<tracked, false> pool(4096, sizeof(tracked));
+        for (size_t i = 0; i < 100; ++i)
+            (void)pool.alloc(&destroyed);
+        pool.clear();
+        CHECK(destroyed == 0);
+        CHECK(pool.stats().live_chunks == 0);
+    }
+}
+
+TEST_CASE("Bitmap pool")
+{
+    using namespace Catch::Matchers;
+
+    SECTION("Chunks smaller than a pointer")
+    {
+        pool::bitmap_pool<uint8_t> bytes(1000, 1);
+        CHECK(bytes.chunks_in_block() == 1000);
+
+        std::vector<uint8_t *> chunks;
+        for (size_t i = 0; i < 2500; ++i)
+            chunks.push_back(bytes.alloc(static_cast<uint8_t>(i)));
+        CHECK(bytes.block_count() == 3);
+        CHECK(bytes.size() == 2500);
+
+        // Consecutive chunks of a block are one byte apart
+        CHECK(chunks[1] == chunks[0] + 1);
+        for (size_t i = 0; i < chunks.size(); ++i)
+            REQUIRE(*chunks[i] == static_cast<uint8_t>(i));
+
+        for (auto &p : chunks)
+            bytes.release(p);
+        CHECK(bytes.size() == 0);
+        CHECK(bytes.block_count() == 1);
+    }
+
+    SECTION("Blocks with many words of chunks")
+    {
+        pool::bitmap_pool<uint8_t> bytes(100000, 1);
+
+        std::vector<uint8_t *> chunks(100000);
+        for (auto &chunk : chunks)
+            chunk = bytes.alloc();
+        CHECK(bytes.block_count() == 1);
+
+        // The only free chunks are at the end of the block, far from the last one found
+        auto *last = chunks[99990];
+        bytes.release(chunks[99990]);
+        bytes.release(chunks[0]);
+        chunks[0]     = bytes.alloc();
+        chunks[99990] = bytes.alloc();
+        CHECK(chunks[99990] == last);
+        CHECK(bytes.block_count() == 1);
+
+        for (auto &chunk : chunks)
+            bytes.release(chunk);
+    }
+
+    SECTION("The lowest free chunk is reused first")
+    {
+        pool::bitmap_pool<void> chunks(3 * 200, 3);
+
+        std::vector<void *> p(200);
+        for (auto &chunk : p)
+            chunk = chunks.alloc();
+
+        auto *low  = p[70];
+        auto *high = p[150];
+        chunks.release(p[150]);
+        chunks.release(p[70]);
+        CHECK(chunks.size() == 198);
+
+        p[70]  = chunks.alloc();
+        p[150] = chunks.alloc();
+        CHECK(p[70] == low);
+        CHECK(p[150] == high);
+
+        for (auto &chunk : p)
+            chunks.release(chunk);
+    }
+
+    SECTION("Double free and foreign pointers are detected")
+    {
+        pool::bitmap_pool<uint32_t> numbers(4096, 4);
+
+        auto *n    = numbers.alloc(7u);
+        auto *copy = n;
+        CHECK(numbers.is_live(n));
+        numbers.release(n);
+        CHECK_FALSE(numbers.is_live(copy));
+        CHECK_THROWS_WITH(numbers.release(copy), ContainsSubstring("twice"));
+
+        auto *inside = reinterpret_cast<uint32_t *>(reinterpret_cast<uint8_t *>(numbers.alloc(8u)) + 1);
+        CHECK_THROWS_WITH(numbers.release(inside), ContainsSubstring("beginning of a chunk"));
+
+        uint32_t local { 0 };
+        auto *foreign = &local;
+        CHECK_THROWS_WITH(numbers.release(foreign), ContainsSubstring("does not belong"));
+
+        // A pointer into the spare block, which is empty and no longer in use
+        pool::bitmap_pool<uint32_t> two(4096, 4);
+        std::vector<uint32_t *> chunks;
+        for (uint32_t i = 0; i < 1025; ++i)
+            chunks.push_back(two.alloc(i));
+        REQUIRE(two.block_count() == 2);
+
+        auto *stale = chunks.back();
+        two.release(chunks.back());
+        REQUIRE(two.block_count() == 1);
+        CHECK_THROWS_WITH(two.release(stale), ContainsSubstring("does not belong"));
+        CHECK_THROWS_WITH((void)two.is_live(stale), ContainsSubstring("does not belong"));
+
+        for (auto &p : chunks)
+            two.release(p);
+    }
+
+    SECTION("Live chunks can be visited")
+    {
+        pool::bitmap_pool<uint64_t> numbers(64 * 100, 64);
+        CHECK(numbers.chunk_alignment() == 64);
+
+        std::vector<uint64_t *> chunks;
+        for (uint64_t i = 0; i < 350; ++i)
+            chunks.push_back(numbers.alloc(i));
+        for (size_t i = 0; i < chunks.size(); i += 3)
+            numbers.release(chunks[i]);
+
+        uint64_t sum   = 0;
+        size_t visited = 0;
+        numbers.for_each_live([&](uint64_t *p) {
+            REQUIRE(reinterpret_cast<uintptr_t>(p) % 64 == 0);
+            sum += *p;
+            ++visited;
+        });
+
+        uint64_t expected = 0;
+        for (uint64_t i = 0; i < 350; ++i)
+            expected += i % 3 == 0 ? 0 : i;
+        CHECK(visited == numbers.size());
+        CHECK(sum == expected);
+
+        for (auto &p : chunks)
+            numbers.release(p);
+    }
+}
+
+namespace
+{
+    struct alignas(32) vector_lanes
+    {
+        std::array<double, 4> lanes {};
+    };
+
+    // Constant initialized: usable before any dynamic initialization
+    constinit pool::static_pool<vector_lanes, 64> global_lanes;
+} // namespace
+
+TEST_CASE("Static pool")
+{
+    using namespace Catch::Matchers;
+
+    // The geometry is known at compile time
+    static_assert(pool::static_pool<vector_lanes, 64>::chunk_size == 32);
+    static_assert(pool::static_pool<vector_lanes, 64>::chunk_alignment == 32);
+    static_assert(pool::static_pool<uint8_t, 16>::chunk_size == sizeof(uint16_t));
+    static_assert(std::is_same_v<pool::static_pool<uint64_t, 100000>::index_type, uint32_t>);
+
+    SECTION("Allocation up to the capacity")
+    {
+        std::vector<vector_lanes *> lanes;
+        while (!global_lanes.full())
+        {
+            lanes.push_back(global_lanes.alloc(vector_lanes { { 1.0, 2.0, 3.0, static_cast<double>(lanes.size()) } }));
+            REQUIRE(reinterpret_cast<uintptr_t>(lanes.back()) % 32 == 0);
+        }
+        CHECK(lanes.size() == 64);
+        CHECK_THROWS_WITH(global_lanes.alloc(), ContainsSubstring("out of chunks"));
+
+        for (std::size_t i = 0; i < lanes.size(); ++i)
+            REQUIRE(lanes[i]->lanes[3] == static_cast<double>(i));
+
+        // The last chunk released is the first one reused
+        auto *last = lanes[10];
+        global_lanes.release(lanes[10]);
+        CHECK(lanes[10] == nullptr);
+        CHECK(global_lanes.available() == 1);
+        lanes[10] = global_lanes.alloc();
+        CHECK(lanes[10] == last);
+
+        for (auto &p : lanes)
+            global_lanes.release(p);
+        CHECK(global_lanes.empty());
+    }
+
+    SECTION("Objects are constructed and destroyed")
+    {
+        pool::static_pool<std::string, 8> strings;
+
+        auto *s0 = strings.alloc("a string long enough to live in the heap, not in the object");
+        auto *s1 = strings.alloc(10, 'x');
+        CHECK(*s0 == "a string long enough to live in the heap, not in the object");
+        CHECK(*s1 == "xxxxxxxxxx");
+        CHECK(strings.size() == 2);
+
+        strings.release(s0);
+        strings.release(s1);
+        CHECK(strings.empty());
+    }
+
+    SECTION("Foreign pointers")
+    {
+        pool::static_pool<uint64_t, 8> numbers;
+
+        auto *n = numbers.alloc(1ull);
+        auto *misaligned = reinterpret_cast<uint64_t *>(reinterpret_cast<uint8_t *>(n) + 1);
+        uint64_t local { 0 };
+        auto *foreign = &local;
+
+        CHECK_FALSE(numbers.contains(misaligned));
+        CHECK_THROWS_WITH(numbers.release(misaligned), ContainsSubstring("does not belong"));
+        CHECK_THROWS_WITH(numbers.release(foreign), ContainsSubstring("does not belong"));
+        numbers.release(n);
+    }
+}
+
 TEST_CASE("Multiple pools")
 {
     pool::memory_pool<size_t> pool(4096, 1024);
@@ -401,6 +874,69 @@ TEST_CASE("Benchmarking")
 }
 
 
+TEST_CASE("Allocations reuse chunks of non-full blocks")
+{
+    pool::memory_pool<uint64_t> pool(4096, 8);
+
+    std::vector<uint64_t *> p64;
+    for (uint64_t a = 0; a < 512 * 4; ++a)
+        p64.emplace_back(pool.alloc(a));
+    REQUIRE(pool.block_count() == 4);
+
+    // Release a chunk of the first filled block; it is the only one with available chunks
+    auto *released = p64[10];
+    auto *checkAddress = released;
+    pool.release(released);
+
+    p64[10] = pool.alloc(10ull);
+    CHECK(p64[10] == checkAddress);
+    CHECK(pool.block_count() == 4);
+
+    // Once every block is full again, a new block is allocated
+    auto *extra = pool.alloc(0ull);
+    CHECK(pool.block_count() == 5);
+    CHECK(pool.used_chunks_in_block(extra) == 1);
+
+    pool.release(extra);
+    CHECK(pool.block_count() == 4);
+
+    for (auto &p : p64)
+        pool.release(p);
+}
+
+TEST_CASE("Allocation latency with full blocks")
+{
+    for (const size_t fullBlocks : std::array<size_t, 3> { 1, 64, 4096 })
+    {
+        pool::memory_pool<size_t> pool(4096, 8);
+
+        // Fill the blocks and leave one extra block with a single chunk in use
+        std::vector<size_t *> filled;
+        filled.reserve(fullBlocks * 512 + 1);
+        for (size_t i = 0; i < fullBlocks * 512 + 1; ++i)
+            filled.push_back(pool.alloc(i));
+
+        BENCHMARK_ADVANCED("Allocation with " + std::to_string(fullBlocks) + " full blocks")
+        (Catch::Benchmark::Chronometer meter)
+        {
+            std::vector<size_t *> poolObject;
+            poolObject.reserve(256);
+
+            meter.measure([&] {
+                for (size_t i = 0; i < 256; ++i)
+                    poolObject.push_back(pool.alloc(i));
+                for (auto &p : poolObject)
+                    pool.release(p);
+                poolObject.clear();
+            });
+        };
+
+        for (auto &p : filled)
+            pool.release(p);
+    }
+}
+
+
 #if defined REPORT_ALLOCATIONS && defined CHECK_MEMORY_LEAK
 template<typename T>
 using pool_iostream_reporter = pool::pool_allocator<T, pool::allocator_iostream_reporter, pool::pool_iostream_reporter>;
@@ -413,6 +949,249 @@ using pool_iostream_reporter = pool::pool_allocator<T>;
 #endif /*REPORT_ALLOCATIONS*/
 
 
+TEST_CASE("Size classes")
+{
+    using global_allocator = pool_iostream_reporter<char>::global_allocator;
+
+    CHECK(global_allocator::adjust_chunk_size(1) == 8);
+    CHECK(global_allocator::adjust_chunk_size(8) == 8);
+    CHECK(global_allocator::adjust_chunk_size(9) == 16);
+    CHECK(global_allocator::adjust_chunk_size(24) == 32);
+    CHECK(global_allocator::adjust_chunk_size(64) == 64);
+    CHECK(global_allocator::adjust_chunk_size(65) == 80);
+    CHECK(global_allocator::adjust_chunk_size(128) == 128);
+    CHECK(global_allocator::adjust_chunk_size(129) == 160);
+    CHECK(global_allocator::adjust_chunk_size(4096) == 4096);
+    CHECK(global_allocator::adjust_chunk_size(4097) == 5120);
+
+    // Every chunk size maps to its own size class
+    for (size_t i = 0; i < pool::size_classes::count; ++i)
+        REQUIRE(pool::size_classes::index(pool::size_classes::chunk_size(i)) == i);
+}
+
+TEST_CASE("Large allocations")
+{
+    using global_allocator = pool_iostream_reporter<char>::global_allocator;
+
+    // Blocks stay bounded no matter the chunk size
+    CHECK(global_allocator::usable_size_from_chunk_size(64) == 64000);
+    CHECK(global_allocator::usable_size_from_chunk_size(65536) == global_allocator::max_block_size);
+    CHECK(global_allocator::usable_size_from_chunk_size(global_allocator::large_allocation_threshold) % global_allocator::large_allocation_threshold == 0);
+    CHECK(global_allocator::usable_size_from_chunk_size(global_allocator::large_allocation_threshold) <= global_allocator::max_block_size);
+
+    CHECK(global_allocator::adjust_chunk_size(global_allocator::large_allocation_threshold + 1) == global_allocator::large_allocation_threshold + 4096);
+
+    std::vector<uint64_t, pool_iostream_reporter<uint64_t>> u64v(1 << 17); // 1 MiB
+    REQUIRE(reinterpret_cast<uintptr_t>(u64v.data()) % 4096 == 0);
+
+    for (size_t i = 0; i < u64v.size(); ++i)
+        u64v[i] = i;
+    for (size_t i = 0; i < u64v.size(); ++i)
+        REQUIRE(u64v[i] == i);
+
+    u64v.resize(1 << 18);
+    CHECK(u64v[(1 << 17) - 1] == (1 << 17) - 1);
+}
+
+TEST_CASE("Page map")
+{
+    SECTION("Pages are tagged and cleared")
+    {
+        pool::page_map pages;
+        alignas(pool::page_map::page_size) static uint8_t memory[4 * pool::page_map::page_size];
+
+        CHECK(pages.find(memory) == 0);
+        REQUIRE(pages.assign(memory + pool::page_map::page_size, 2 * pool::page_map::page_size, 7));
+        CHECK(pages.find(memory) == 0);
+        CHECK(pages.find(memory + pool::page_map::page_size) == 7);
+        CHECK(pages.find(memory + 3 * pool::page_map::page_size - 1) == 7);
+        CHECK(pages.find(memory + 3 * pool::page_map::page_size) == 0);
+
+        REQUIRE(pages.assign(memory, sizeof(memory), 0));
+        CHECK(pages.find(memory + pool::page_map::page_size) == 0);
+
+        // Above the address bits the map covers
+        CHECK_FALSE(pages.assign(reinterpret_cast<void *>(uintptr_t { 1 } << pool::page_map::address_bits), 1, 1));
+        CHECK(pages.find(reinterpret_cast<void *>(uintptr_t { 1 } << pool::page_map::address_bits)) == 0);
+    }
+
+    SECTION("Pools tag the pages of their blocks")
+    {
+        pool::page_map pages;
+        pool::memory_pool<uint64_t> pool(4096 * 4, 64, pool::pool_options { .retained_blocks = 0, .backing = pool::block_backing::mapped, .pages = &pages, .page_tag = 3 });
+
+        std::vector<uint64_t *> p64;
+        for (uint64_t a = 0; a < 4096 * 4 / 64 + 1; ++a)
+        {
+            p64.emplace_back(pool.alloc(a));
+            REQUIRE(pages.find(p64.back()) == 3);
+        }
+        CHECK(pool.block_count() == 2);
+
+        // The second block is freed when it becomes empty
+        auto *last = p64.back();
+        pool.release(last);
+        CHECK(pool.block_count() == 1);
+        CHECK(pages.find(last) == 0);
+
+        p64.pop_back();
+        for (auto &p : p64)
+            pool.release(p);
+    }
+
+    SECTION("global_allocator finds the size class of a pointer")
+    {
+        using global_allocator = pool_iostream_reporter<char>::global_allocator;
+        global_allocator allocator;
+
+        auto *p = allocator.allocate(100);
+        CHECK(allocator.pooled_chunk_size(p) == global_allocator::adjust_chunk_size(100));
+        allocator.deallocate(p, global_allocator::adjust_chunk_size(100));
+
+        auto *large = allocator.allocate(global_allocator::large_allocation_threshold + 1);
+        CHECK(allocator.pooled_chunk_size(large) == 0);
+        allocator.deallocate(large, global_allocator::adjust_chunk_size(global_allocator::large_allocation_threshold + 1));
+
+        int local = 0;
+        CHECK(allocator.pooled_chunk_size(&local) == 0);
+    }
+}
+
+TEST_CASE("In place expansion")
+{
+    using global_allocator = pool_iostream_reporter<char>::global_allocator;
+
+    SECTION("allocate_at_least returns the capacity of the chunk")
+    {
+        pool_iostream_reporter<uint32_t> allocator;
+
+        auto [p, count] = allocator.allocate_at_least(17); // 68 bytes, in the 80 bytes class
+        CHECK(count == 20);
+        for (std::size_t i = 0; i < count; ++i)
+            p[i] = static_cast<uint32_t>(i);
+
+        CHECK(allocator.try_expand(p, 17, 20));
+        CHECK_FALSE(allocator.try_expand(p, 20, 21));
+        CHECK(p[19] == 19);
+        allocator.deallocate(p, count);
+    }
+
+    SECTION("Pooled chunks keep their size class")
+    {
+        global_allocator allocator;
+
+        void *p = allocator.allocate(65);
+        CHECK(allocator.try_expand(p, 80, 80));
+        CHECK_FALSE(allocator.try_expand(p, 80, 81));
+        CHECK_FALSE(allocator.try_expand(p, 80, 64));
+        CHECK_FALSE(allocator.try_expand(p, 80, global_allocator::large_allocation_threshold + 1));
+
+        std::memset(p, 7, 80);
+        auto *q = static_cast<uint8_t *>(allocator.reallocate(p, 80, 1000));
+        CHECK(q[79] == 7);
+        allocator.deallocate(q, global_allocator::adjust_chunk_size(1000));
+    }
+
+    SECTION("Large allocations are remapped")
+    {
+        global_allocator allocator;
+
+        const std::size_t size = global_allocator::large_allocation_threshold + 8192;
+        auto *p                = static_cast<uint8_t *>(allocator.allocate(size));
+        p[0]                   = 1;
+
+        // Shrinking always succeeds; growing only if the pages after the mapping are free
+        CHECK(allocator.try_expand(p, size, size - 4096));
+        CHECK(allocator.stats().large_bytes == size - 4096);
+
+        std::size_t chunkSize = size - 4096;
+        if (allocator.try_expand(p, chunkSize, 4 * size))
+        {
+            chunkSize = 4 * size;
+            CHECK(p[4 * size - 1] == 0);
+        }
+        CHECK(allocator.stats().large_bytes == chunkSize);
+
+        auto *q = static_cast<uint8_t *>(allocator.reallocate(p, chunkSize, 8 * size));
+        q[8 * size - 1] = 1;
+        CHECK(q[0] == 1);
+        allocator.deallocate(q, 8 * size);
+        CHECK(allocator.stats().large_bytes == 0);
+    }
+}
+
+TEST_CASE("Over-aligned allocations")
+{
+    using namespace Catch::Matchers;
+    using global_allocator = pool_iostream_reporter<char>::global_allocator;
+
+    struct alignas(64) cache_line
+    {
+        std::array<float, 16> lanes {};
+    };
+
+    SECTION("Size classes aligned to the request")
+    {
+        CHECK(global_allocator::adjust_chunk_size(8, 16) == 16);
+        CHECK(global_allocator::adjust_chunk_size(100, 16) == 112);
+        CHECK(global_allocator::adjust_chunk_size(48, 32) == 64);
+        CHECK(global_allocator::adjust_chunk_size(65, 64) == 128);
+        CHECK(global_allocator::adjust_chunk_size(129, 64) == 192);
+        CHECK(global_allocator::adjust_chunk_size(100, 4096) == 4096);
+        CHECK(global_allocator::adjust_chunk_size(300000, 64) == global_allocator::adjust_chunk_size(300000));
+
+        global_allocator allocator;
+        for (std::size_t alignment = 8; alignment <= global_allocator::max_alignment; alignment *= 2)
+        {
+            for (std::size_t n = 1; n < 20000; n = n * 3 + 1)
+            {
+                void *p = allocator.allocate(n, alignment);
+                REQUIRE(reinterpret_cast<uintptr_t>(p) % alignment == 0);
+                std::memset(p, 1, n);
+                allocator.deallocate(p, global_allocator::adjust_chunk_size(n, alignment));
+            }
+        }
+
+        CHECK_THROWS_WITH(allocator.allocate(64, 48), ContainsSubstring("power of two"));
+        CHECK_THROWS_WITH(allocator.allocate(64, global_allocator::max_alignment * 2), ContainsSubstring("max_alignment"));
+    }
+
+    SECTION("pool_allocator follows the alignment of the type")
+    {
+        std::vector<cache_line, pool_iostream_reporter<cache_line>> lines;
+        for (std::size_t i = 0; i < 100; ++i)
+        {
+            lines.emplace_back();
+            lines.back().lanes[15] = static_cast<float>(i);
+            REQUIRE(reinterpret_cast<uintptr_t>(lines.data()) % 64 == 0);
+        }
+        CHECK(lines[99].lanes[15] == 99.0f);
+
+        std::list<cache_line, pool_iostream_reporter<cache_line>> nodes;
+        for (std::size_t i = 0; i < 10; ++i)
+            nodes.emplace_back();
+        for (auto &node : nodes)
+            CHECK(reinterpret_cast<uintptr_t>(&node) % 64 == 0);
+    }
+
+    SECTION("memory_pool chunks of over-aligned types")
+    {
+        CHECK_THROWS_WITH((pool::memory_pool<cache_line>(96 * 32, 96)), ContainsSubstring("alignment of T"));
+
+        pool::memory_pool<cache_line> lines(4096 * 3, 192);
+        CHECK(lines.chunk_alignment() == 64);
+
+        std::vector<cache_line *> chunks;
+        for (std::size_t i = 0; i < 200; ++i)
+        {
+            chunks.push_back(lines.alloc());
+            REQUIRE(reinterpret_cast<uintptr_t>(chunks.back()) % 64 == 0);
+        }
+        for (auto *chunk : chunks)
+            lines.release(chunk);
+    }
+}
+
 TEST_CASE("String allocator")
 {
 
@@ -494,3 +1273,886 @@ TEST_CASE("Allocator vector")
     CHECK(u64v[1] == 0xaaffbbccddffbbccull);
     CHECK(u64v[2] == 0xbbffbbccddffbbccull);
 }
+
+TEST_CASE("Allocator from multiple threads")
+{
+    using wbstring = std::basic_string<char, std::char_traits<char>, pool_iostream_reporter<char>>;
+
+    // Keep the global allocator alive while the threads come and go
+    pool_iostream_reporter<char> keepAlive;
+
+    std::vector<std::thread> threads;
+    std::vector<int> results(4, 0);
+    for (size_t t = 0; t < results.size(); ++t)
+    {
+        threads.emplace_back([t, &results] {
+            std::vector<wbstring, pool_iostream_reporter<wbstring>> sv;
+            for (size_t i = 0; i < 2000; ++i)
+                sv.emplace_back(std::string(16 + (i % 200), static_cast<char>('a' + t)).c_str());
+
+            int valid = 1;
+            for (size_t i = 0; i < sv.size(); ++i)
+            {
+                if (sv[i] != std::string(16 + (i % 200), static_cast<char>('a' + t)).c_str())
+                    valid = 0;
+            }
+            results[t] = valid;
+        });
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    for (const auto &valid : results)
+        CHECK(valid == 1);
+}
+
+TEST_CASE("Multi-threaded allocations of different size classes")
+{
+    // Sizes above the thread cache limit always go through the size class lock
+    constexpr std::array<size_t, 4> sizes { 32768, 65536, 131072, 262144 };
+
+    pool_iostream_reporter<char> allocator;
+    std::mutex globalMutex;
+
+    auto run = [&](bool singleLock) {
+        std::vector<std::thread> threads;
+        for (const auto size : sizes)
+        {
+            threads.emplace_back([&, size] {
+                std::array<char *, 16> ptrs {};
+                for (int i = 0; i < 200; ++i)
+                {
+                    for (auto &p : ptrs)
+                    {
+                        std::unique_lock<std::mutex> lock(globalMutex, std::defer_lock);
+                        if (singleLock)
+                            lock.lock();
+                        p = allocator.allocate(size);
+                    }
+                    for (auto &p : ptrs)
+                    {
+                        std::unique_lock<std::mutex> lock(globalMutex, std::defer_lock);
+                        if (singleLock)
+                            lock.lock();
+                        allocator.deallocate(p, size);
+                    }
+                }
+            });
+        }
+
+        for (auto &thread : threads)
+            thread.join();
+    };
+
+    BENCHMARK("Per size class locks")
+    {
+        run(false);
+    };
+
+    BENCHMARK("Single global lock")
+    {
+        run(true);
+    };
+}
+
+TEST_CASE("Huge page backed blocks")
+{
+    constexpr size_t hugePage = 2 << 20;
+
+    pool::memory_pool<uint64_t> pool(4096 * 20, 64, pool::pool_options { .backing = pool::block_backing::huge_pages });
+
+    // The block fills a whole huge page, together with the block information
+    CHECK(pool.get_block_size() < hugePage);
+    CHECK(pool.get_block_size() > hugePage - 4096);
+    CHECK(pool.get_block_size() % 64 == 0);
+
+    const auto chunks = pool.get_block_size() / 64;
+    std::vector<uint64_t *> p64;
+    for (uint64_t a = 0; a < chunks + 1; ++a)
+        p64.emplace_back(pool.alloc(a));
+    CHECK(pool.block_count() == 2);
+
+    for (uint64_t a = 0; a < p64.size(); ++a)
+        REQUIRE(*p64[a] == a);
+
+    for (auto &p : p64)
+        pool.release(p);
+    CHECK(pool.block_count() == 1);
+}
+
+TEST_CASE("Blocks mapped from the system")
+{
+    pool::memory_pool<uint64_t> pool(4096 * 20, 64, pool::pool_options { .retained_blocks = 1, .backing = pool::block_backing::mapped });
+    CHECK(pool.get_block_size() == 4096 * 20);
+
+    const auto chunks = pool.get_block_size() / 64;
+    std::vector<uint64_t *> p64;
+    for (uint64_t a = 0; a < chunks + 1; ++a)
+        p64.emplace_back(pool.alloc(a));
+    CHECK(pool.block_count() == 2);
+
+    for (uint64_t a = 0; a < p64.size(); ++a)
+        REQUIRE(*p64[a] == a);
+
+    for (auto &p : p64)
+        pool.release(p);
+    CHECK(pool.block_count() == 1);
+
+    // Fresh mappings are not resident, so only the pages that were used are purged: the first block, and little
+    // of the second one
+    const auto purged = pool.purge();
+    CHECK(purged >= pool.get_block_size());
+    CHECK(purged < 2 * pool.get_block_size());
+}
+
+TEST_CASE("Random access traversal with huge pages")
+{
+    struct node
+    {
+        node *next { nullptr };
+        std::array<uint64_t, 7> payload {};
+    };
+
+    constexpr size_t nodes = 1 << 19; // 32 MiB of nodes
+
+    auto traverse = [](pool::block_backing backing, const std::string &name) {
+        pool::memory_pool<node> pool(2 << 20, sizeof(node), pool::pool_options { .backing = backing });
+
+        std::vector<node *> order;
+        order.reserve(nodes);
+        for (size_t i = 0; i < nodes; ++i)
+            order.push_back(pool.alloc());
+
+        // Link the nodes in a random order, so every step of the traversal lands far from the previous node
+        std::mt19937 mt(1234);
+        std::shuffle(order.begin(), order.end(), mt);
+        for (size_t i = 0; i < nodes - 1; ++i)
+            order[i]->next = order[i + 1];
+
+        BENCHMARK(name.c_str())
+        {
+            uint64_t sum = 0;
+            for (node *n = order[0]; n != nullptr; n = n->next)
+                sum += n->payload[0];
+            return sum;
+        };
+
+        for (auto &p : order)
+            pool.release(p);
+    };
+
+    traverse(pool::block_backing::heap, "Pointer chasing, regular pages");
+    traverse(pool::block_backing::huge_pages, "Pointer chasing, huge pages");
+}
+
+TEST_CASE("Batch allocation and release")
+{
+    pool::memory_pool<uint64_t> pool(4096, 8);
+
+    // Leave a hole in the first block, so the batch uses both released and untouched chunks
+    std::vector<uint64_t *> single;
+    for (uint64_t a = 0; a < 4; ++a)
+        single.emplace_back(pool.alloc(a));
+    auto *released = single[1];
+    pool.release(released);
+
+    std::vector<uint64_t *> batch(2000);
+    pool.alloc_n(std::span<uint64_t *>(batch), 0x45ull);
+    CHECK(batch[0] == single[0] + 1);
+    CHECK(pool.block_count() == 4);
+
+    for (auto *p : batch)
+        REQUIRE(*p == 0x45ull);
+
+    // Every chunk is different
+    std::vector<uint64_t *> sorted(batch);
+    std::sort(sorted.begin(), sorted.end());
+    CHECK(std::adjacent_find(sorted.begin(), sorted.end()) == sorted.end());
+
+    CHECK(pool.used_chunks_in_block(single[0]) == 512);
+
+    pool.release_n(std::span<uint64_t *>(batch));
+    for (auto *p : batch)
+        REQUIRE(p == nullptr);
+
+    CHECK(pool.block_count() == 1);
+    CHECK(pool.used_chunks_in_block(single[0]) == 3);
+
+    pool.release(single[0]);
+    pool.release(single[2]);
+    pool.release(single[3]);
+}
+
+TEST_CASE("Batch allocation benchmark")
+{
+    pool::memory_pool<size_t> pool(4096 * 20, 8);
+
+    std::vector<size_t *> objects(10'000);
+
+    BENCHMARK("Individual alloc/release")
+    {
+        for (auto &p : objects)
+            p = pool.alloc();
+        for (auto &p : objects)
+            pool.release(p);
+    };
+
+    BENCHMARK("Batch alloc_n/release_n")
+    {
+        pool.alloc_n(std::span<size_t *>(objects));
+        pool.release_n(std::span<size_t *>(objects));
+    };
+}
+
+#if defined REPORT_ALLOCATIONS && defined CHECK_MEMORY_LEAK
+using global_resource      = pool::global_allocator_resource<pool::allocator_iostream_reporter, pool::pool_iostream_reporter>;
+using memory_pool_resource = pool::memory_pool_resource<pool::pool_iostream_reporter>;
+#elif !defined(REPORT_ALLOCATIONS) && defined CHECK_MEMORY_LEAK
+using global_resource      = pool::global_allocator_resource<pool::pool_iostream_reporter>;
+using memory_pool_resource = pool::memory_pool_resource<pool::pool_iostream_reporter>;
+#else
+using global_resource      = pool::global_allocator_resource;
+using memory_pool_resource = pool::memory_pool_resource;
+#endif /*REPORT_ALLOCATIONS*/
+
+TEST_CASE("Polymorphic memory resources")
+{
+    SECTION("Global allocator resource")
+    {
+        global_resource resource;
+
+        std::pmr::vector<std::pmr::string> sv(&resource);
+        for (size_t i = 0; i < 2000; ++i)
+            sv.emplace_back(16 + (i % 300), static_cast<char>('a' + (i % 26)));
+
+        for (size_t i = 0; i < sv.size(); ++i)
+            REQUIRE(sv[i] == std::pmr::string(16 + (i % 300), static_cast<char>('a' + (i % 26))));
+
+        // Large allocations bypass the pools
+        std::pmr::vector<uint64_t> u64v(1 << 16, 0x45ull, &resource);
+        CHECK(u64v.back() == 0x45ull);
+
+        // Over-aligned requests get the first size class that is a multiple of the alignment
+        for (size_t alignment = 8; alignment <= 4096; alignment *= 2)
+        {
+            void *p = resource.allocate(48, alignment);
+            CHECK(reinterpret_cast<uintptr_t>(p) % alignment == 0);
+            resource.deallocate(p, 48, alignment);
+        }
+    }
+
+    SECTION("Resources are isolated")
+    {
+        global_resource first;
+        global_resource second(true);
+
+        CHECK(first.is_equal(first));
+        CHECK_FALSE(first.is_equal(second));
+
+        std::pmr::unordered_map<uint64_t, uint64_t> m0(&first);
+        std::pmr::unordered_map<uint64_t, uint64_t> m1(&second);
+        for (uint64_t i = 0; i < 5000; ++i)
+        {
+            m0.emplace(i, i * 2);
+            m1.emplace(i, i * 3);
+        }
+
+        for (uint64_t i = 0; i < 5000; ++i)
+        {
+            REQUIRE(m0[i] == i * 2);
+            REQUIRE(m1[i] == i * 3);
+        }
+
+        // Chunks of one resource don't belong to the pools of the other
+        auto *p = first.allocate(64);
+        CHECK_THROWS_AS(second.get_allocator().create_pool(64000, 64)->release(p), std::out_of_range);
+        first.deallocate(p, 64);
+    }
+
+    SECTION("Memory pool resource")
+    {
+        memory_pool_resource resource(4096, 32);
+
+        std::pmr::list<uint64_t> l(&resource);
+        for (uint64_t i = 0; i < 1000; ++i)
+            l.push_back(i);
+
+        // Every node is a chunk of the pool
+        CHECK(resource.get_pool().block_count() == 8);
+        CHECK(resource.get_pool().used_chunks_in_block(&l.front()) == 128);
+
+        // Requests bigger than a chunk go upstream
+        std::pmr::vector<uint64_t> u64v(100, 0x45ull, &resource);
+        CHECK(u64v.back() == 0x45ull);
+        CHECK(resource.upstream_resource() == std::pmr::get_default_resource());
+
+        l.clear();
+        CHECK(resource.get_pool().block_count() == 1);
+    }
+}
+
+TEST_CASE("Chunks freed from another thread")
+{
+    global_resource resource;
+    auto *pool = resource.get_allocator().create_pool(global_resource::allocator_type::usable_size_from_chunk_size(64), 64);
+
+    std::vector<void *> chunks(4000);
+    for (auto &p : chunks)
+        p = resource.allocate(64);
+    const auto blocks = pool->block_count();
+    CHECK(blocks == 4);
+
+    // Nobody else holds the size class, so the frees go straight to the pool and its empty blocks are released
+    std::thread consumer([&chunks, &resource] {
+        for (auto *p : chunks)
+            resource.deallocate(p, 64);
+    });
+    consumer.join();
+    CHECK(pool->block_count() == 1);
+    CHECK(pool->retained_block_count() == 1); // The size classes keep an empty block
+
+    // Frees that find the size class locked are pushed to its remote free list, and taken back by the next
+    // allocation or collect_remote_frees
+    for (auto &p : chunks)
+        p = resource.allocate(64);
+    CHECK(pool->block_count() == blocks);
+
+    std::vector<std::thread> consumers;
+    for (std::size_t i = 0; i < 4; ++i)
+        consumers.emplace_back([&chunks, &resource, i] {
+            for (std::size_t j = i; j < chunks.size(); j += 4)
+                resource.deallocate(chunks[j], 64);
+        });
+    for (auto &thread : consumers)
+        thread.join();
+
+    resource.get_allocator().collect_remote_frees();
+    CHECK(pool->block_count() == 1);
+}
+
+TEST_CASE("Producer/consumer benchmark")
+{
+    // Single producer single consumer ring of messages
+    struct message_queue
+    {
+        std::array<std::atomic<void *>, 1024> slots {};
+        std::atomic<size_t> head { 0 };
+        std::atomic<size_t> tail { 0 };
+
+        void push(void *p)
+        {
+            const auto t = tail.load(std::memory_order_relaxed);
+            while (t - head.load(std::memory_order_acquire) == slots.size())
+                std::this_thread::yield();
+            slots[t % slots.size()].store(p, std::memory_order_relaxed);
+            tail.store(t + 1, std::memory_order_release);
+        }
+
+        auto pop() -> void *
+        {
+            const auto h = head.load(std::memory_order_relaxed);
+            while (tail.load(std::memory_order_acquire) == h)
+                std::this_thread::yield();
+            auto *p = slots[h % slots.size()].load(std::memory_order_relaxed);
+            head.store(h + 1, std::memory_order_release);
+            return p;
+        }
+    };
+
+    constexpr size_t messages = 100'000;
+
+    auto pipeline = [](auto allocate, auto deallocate) {
+        message_queue queue;
+        std::thread consumer([&queue, &deallocate] {
+            for (size_t i = 0; i < messages; ++i)
+                deallocate(queue.pop());
+        });
+
+        for (size_t i = 0; i < messages; ++i)
+            queue.push(allocate());
+        consumer.join();
+    };
+
+    pool_iostream_reporter<char> allocator;
+    global_resource resource;
+
+    BENCHMARK("pool_allocator (thread caches)")
+    {
+        pipeline([&allocator] { return allocator.allocate(48); }, [&allocator](void *p) { allocator.deallocate(static_cast<char *>(p), 48); });
+    };
+
+    BENCHMARK("global_allocator_resource (no thread caches)")
+    {
+        pipeline([&resource] { return resource.allocate(48); }, [&resource](void *p) { resource.deallocate(p, 48); });
+    };
+
+    BENCHMARK("new/delete")
+    {
+        pipeline([] { return ::operator new(48); }, [](void *p) { ::operator delete(p); });
+    };
+}
+
+#if defined(__linux__)
+// Number of resident pages in [p, p + size)
+static auto resident_pages(void *p, size_t size) -> size_t
+{
+    std::vector<unsigned char> pages(size / 4096);
+    mincore(p, size, pages.data());
+    return static_cast<size_t>(std::count_if(pages.begin(), pages.end(), [](unsigned char page) { return (page & 1) != 0; }));
+}
+#endif /*__linux__*/
+
+TEST_CASE("Purging idle pages")
+{
+    REQUIRE(pool::system::page_size() == 4096);
+
+    SECTION("Released chunks at the top of a block")
+    {
+        pool::memory_pool<uint64_t> pool(65536, 8);
+
+        std::vector<uint64_t *> p64;
+        for (uint64_t a = 0; a < 8192; ++a)
+            p64.emplace_back(pool.alloc(a));
+        [[maybe_unused]] auto *beginning = pool.block_address(p64[0]);
+
+        // Release the upper half in random order, and a few chunks below it
+        std::vector<uint64_t *> released(p64.begin() + 4096, p64.end());
+        std::shuffle(released.begin(), released.end(), std::mt19937 { 0x45 });
+        for (auto *p : released)
+            pool.release(p);
+        auto *chunk100  = p64[100];
+        auto *chunk4095 = p64[4095];
+        auto *chunk4096 = p64[4096];
+        pool.release(p64[100]);
+        pool.release(p64[4095]);
+
+        CHECK(pool.purgeable_bytes() == 0);
+        CHECK(pool.purge() == 32768);
+        CHECK(pool.purgeable_bytes() == 0);
+        CHECK(pool.purge() == 0);
+#if defined(__linux__)
+        CHECK(resident_pages(beginning + 32768, 32768) == 0);
+#endif /*__linux__*/
+
+        // The chunks in use are untouched, and the lowest released chunks are reused first
+        for (uint64_t a = 0; a < 4095; ++a)
+        {
+            if (a != 100)
+                REQUIRE(*p64[a] == a);
+        }
+        p64[100]  = pool.alloc(1);
+        p64[4095] = pool.alloc(2);
+        p64[4096] = pool.alloc(3);
+        CHECK(p64[100] == chunk100);
+        CHECK(p64[4095] == chunk4095);
+        CHECK(p64[4096] == chunk4096);
+        CHECK(pool.used_chunks_in_block(p64[0]) == 4097);
+
+        for (uint64_t a = 0; a < 4097; ++a)
+            pool.release(p64[a]);
+    }
+
+    SECTION("Purge budget")
+    {
+        pool::memory_pool<uint64_t> pool(65536, 8);
+
+        std::vector<uint64_t *> p64;
+        for (uint64_t a = 0; a < 8192; ++a)
+            p64.emplace_back(pool.alloc(a));
+        for (size_t a = 512; a < 8192; ++a)
+            pool.release(p64[a]);
+
+        // The highest pages are purged first
+        CHECK(pool.purge(5000) == 8192);
+        CHECK(pool.purgeable_bytes() == 65536 - 4096 - 8192);
+        CHECK(pool.purge() == 65536 - 4096 - 8192);
+
+        for (size_t a = 0; a < 512; ++a)
+            pool.release(p64[a]);
+    }
+
+    SECTION("Retained blocks")
+    {
+        pool::memory_pool<uint64_t> pool(16384, 8, pool::pool_options { .retained_blocks = 1 });
+
+        std::vector<uint64_t *> p64;
+        for (uint64_t a = 0; a < 4096; ++a)
+            p64.emplace_back(pool.alloc(a));
+        for (size_t a = 2048; a < 4096; ++a)
+            pool.release(p64[a]);
+        REQUIRE(pool.retained_block_count() == 1);
+
+        CHECK(pool.purgeable_bytes() == 16384);
+        CHECK(pool.purge() == 16384);
+
+        // The purged block is reused as a new one
+        for (uint64_t a = 2048; a < 4096; ++a)
+            p64[a] = pool.alloc(a);
+        CHECK(pool.retained_block_hits() == 1);
+        for (uint64_t a = 0; a < 4096; ++a)
+            REQUIRE(*p64[a] == a);
+
+        for (auto *p : p64)
+            pool.release(p);
+    }
+
+    SECTION("Purging without holding the pool")
+    {
+        using pool_type = pool::memory_pool<uint64_t>;
+        pool_type pool(65536, 8, pool::pool_options { .retained_blocks = 1 });
+
+        std::vector<uint64_t *> p64;
+        for (uint64_t a = 0; a < 8192; ++a)
+            p64.emplace_back(pool.alloc(a));
+        for (size_t a = 4096; a < 8192; ++a)
+            pool.release(p64[a]);
+        p64.resize(4096);
+
+        std::array<pool_type::purge_range, 4> ranges;
+        std::vector<uint64_t> released;
+        released.reserve(pool.purge_scratch_size());
+        REQUIRE(pool.begin_purge(std::numeric_limits<size_t>::max(), ranges, released) == 1);
+        auto *first = ranges[0].first;
+        auto *last  = ranges[0].last;
+        CHECK(last - first == 32768);
+
+        // The pages set aside are not handed out until the purge ends
+        std::vector<uint64_t *> during;
+        for (uint64_t a = 0; a < 4096; ++a)
+        {
+            during.emplace_back(pool.alloc(a));
+            auto *address = reinterpret_cast<uint8_t *>(during.back());
+            REQUIRE((address < first || address >= last));
+        }
+        CHECK(pool.block_count() == 2);
+
+        CHECK(pool_type::purge_pages(std::span(ranges.data(), 1)) == 32768);
+#if defined(__linux__)
+        CHECK(resident_pages(first, 32768) == 0);
+#endif /*__linux__*/
+
+        // The first block becomes empty during the purge, so it is retired when the purge ends
+        for (auto &p : p64)
+            pool.release(p);
+        CHECK(pool.block_count() == 2);
+        pool.end_purge(std::span(ranges.data(), 1));
+        CHECK(pool.block_count() == 1);
+        CHECK(pool.retained_block_count() == 1);
+
+        for (uint64_t a = 0; a < 4096; ++a)
+            REQUIRE(*during[a] == a);
+        for (auto &p : during)
+            pool.release(p);
+    }
+}
+
+TEST_CASE("Background decay")
+{
+    global_resource resource;
+    auto *pool = resource.get_allocator().create_pool(global_resource::allocator_type::usable_size_from_chunk_size(64), 64);
+
+    std::vector<void *> chunks(10000);
+    for (auto &p : chunks)
+        p = resource.allocate(64);
+    for (auto *p : chunks)
+        resource.deallocate(p, 64);
+
+    resource.get_allocator().start_decay({ std::chrono::milliseconds { 5 }, std::chrono::milliseconds { 0 } });
+    std::this_thread::sleep_for(std::chrono::milliseconds { 200 });
+    resource.get_allocator().stop_decay();
+
+    // Everything idle was already purged
+    CHECK(pool->purgeable_bytes() == 0);
+    CHECK(resource.get_allocator().purge() == 0);
+
+    // And the memory is still usable
+    auto *p = static_cast<uint64_t *>(resource.allocate(64));
+    *p      = 0x45ull;
+    CHECK(*p == 0x45ull);
+    resource.deallocate(p, 64);
+}
+
+TEST_CASE("Statistics")
+{
+    SECTION("Memory pool")
+    {
+        pool::memory_pool<uint64_t> pool(4096, 8, { .retained_blocks = 1 });
+
+        std::vector<uint64_t *> p64;
+        for (uint64_t a = 0; a < 1024; ++a)
+            p64.emplace_back(pool.alloc(a));
+        pool.release_n(std::span<uint64_t *>(p64.data() + 512, 512));
+
+        auto stats = pool.stats();
+        CHECK(stats.allocations == 1024);
+        CHECK(stats.releases == 512);
+        CHECK(stats.live_chunks == 512);
+        CHECK(stats.used_bytes == 4096);
+        CHECK(stats.blocks == 1);
+        CHECK(stats.retained_blocks == 1);
+        CHECK(stats.block_allocations == 2);
+        CHECK(stats.block_frees == 0);
+        CHECK(stats.reserved_bytes >= 2 * 4096);
+
+        pool.trim();
+        stats = pool.stats();
+        CHECK(stats.retained_blocks == 0);
+        CHECK(stats.block_frees == 1);
+
+        for (size_t a = 0; a < 512; ++a)
+            pool.release(p64[a]);
+        CHECK(pool.stats().live_chunks == 0);
+    }
+
+    SECTION("Global allocator")
+    {
+        global_resource resource(true);
+        auto &allocator = resource.get_allocator();
+
+        std::vector<void *> chunks;
+        for (size_t i = 0; i < 1000; ++i)
+            chunks.emplace_back(resource.allocate(40));
+        for (size_t i = 0; i < 10; ++i)
+            chunks.emplace_back(resource.allocate(20000));
+        auto *large = resource.allocate(1 << 20);
+
+        auto stats = allocator.stats();
+        const auto &class48 = stats.size_classes[pool::size_classes::index(48)];
+        CHECK(class48.chunk_size == 48);
+        CHECK(class48.allocations == 1000);
+        CHECK(class48.live_chunks == 1000);
+        CHECK(class48.pool.live_chunks >= 1000); // Plus the chunks in the thread cache
+        CHECK(stats.size_classes[pool::size_classes::index(20000)].live_chunks == 10);
+        CHECK(stats.large_allocations == 1);
+        CHECK(stats.large_bytes == 1 << 20);
+        CHECK(stats.used_bytes == 1000 * 48 + 10 * global_resource::allocator_type::adjust_chunk_size(20000) + (1 << 20));
+        CHECK(stats.reserved_bytes >= stats.used_bytes);
+
+        // Counters of a finished thread are kept
+        std::thread([&resource] {
+            for (size_t i = 0; i < 100; ++i)
+                resource.deallocate(resource.allocate(40), 40);
+        }).join();
+
+        for (size_t i = 0; i < 1000; ++i)
+            resource.deallocate(chunks[i], 40);
+        for (size_t i = 1000; i < chunks.size(); ++i)
+            resource.deallocate(chunks[i], 20000);
+        resource.deallocate(large, 1 << 20);
+
+        stats = allocator.stats();
+        CHECK(stats.size_classes[pool::size_classes::index(48)].allocations == 1100);
+        CHECK(stats.size_classes[pool::size_classes::index(48)].deallocations == 1100);
+        CHECK(stats.size_classes[pool::size_classes::index(20000)].deallocations == 10);
+        CHECK(stats.large_deallocations == 1);
+        CHECK(stats.used_bytes == 0);
+    }
+}
+
+#if defined REPORT_ALLOCATIONS && defined CHECK_MEMORY_LEAK
+// A reporter written before alloc_granted existed
+struct request_only_reporter
+{
+    static void global_new(void *) noexcept { }
+    static void global_freed(void *) noexcept { }
+    static void add_ref_count(int64_t) noexcept { }
+    static void sub_ref_count(int64_t) noexcept { }
+    static void copy_ctor_ref_count(int64_t) noexcept { }
+    static void move_ctor_ref_count(int64_t) noexcept { }
+    static void alloc_request(std::size_t) noexcept { }
+    static void dealloc_request(const void *const, std::size_t) noexcept { }
+};
+#endif /*REPORT_ALLOCATIONS*/
+
+TEST_CASE("Sampling heap profiler")
+{
+    using profiler = pool::heap_profiler;
+#if defined REPORT_ALLOCATIONS && defined CHECK_MEMORY_LEAK
+    static_assert(pool::allocator_reporter<profiler>);
+    static_assert(pool::granted_memory_reporter<profiler>);
+    static_assert(pool::allocator_reporter<request_only_reporter>);
+    static_assert(!pool::granted_memory_reporter<request_only_reporter>);
+#endif /*REPORT_ALLOCATIONS*/
+
+    // With POOL_HEAP_PROFILER the resource samples its allocations itself
+    global_resource resource;
+    auto allocate = [&resource](size_t size) {
+        void *p = resource.allocate(size);
+#if !defined(POOL_HEAP_PROFILER)
+        profiler::alloc_granted(p, size);
+#endif /*POOL_HEAP_PROFILER*/
+        return p;
+    };
+    auto deallocate = [&resource](void *p, size_t size) {
+#if !defined(POOL_HEAP_PROFILER)
+        profiler::dealloc_request(p, size);
+#endif /*POOL_HEAP_PROFILER*/
+        resource.deallocate(p, size);
+    };
+
+    SECTION("Samples are kept until the memory is freed")
+    {
+        profiler::reset();
+        profiler::set_sampling_interval(1); // Practically every allocation
+
+        std::vector<void *> chunks;
+        for (size_t i = 0; i < 100; ++i)
+            chunks.emplace_back(allocate(64));
+        CHECK(profiler::live_samples() == 100);
+
+        for (size_t i = 0; i < 50; ++i)
+            deallocate(chunks[i], 64);
+        CHECK(profiler::live_samples() == 50);
+
+        std::ostringstream out;
+        profiler::write_profile(out);
+        CHECK(out.str().starts_with("heap profile: 50: 3200 [50: 3200] @ heap_v2/1\n"));
+
+        for (size_t i = 50; i < 100; ++i)
+            deallocate(chunks[i], 64);
+        CHECK(profiler::live_samples() == 0);
+    }
+
+    SECTION("Unbiased estimation of the live heap")
+    {
+        profiler::reset();
+        profiler::set_sampling_interval(profiler::default_sampling_interval);
+
+        // 200 MiB in 4 KiB allocations, about 400 samples
+        std::vector<void *> chunks;
+        for (size_t i = 0; i < 51200; ++i)
+            chunks.emplace_back(allocate(4096));
+
+        const double live = 51200.0 * 4096.0;
+        CHECK(profiler::live_samples() > 250);
+        CHECK(profiler::live_samples() < 600);
+        CHECK(std::abs(profiler::estimated_live_bytes() - live) < live * 0.25);
+
+        for (auto *p : chunks)
+            deallocate(p, 4096);
+        CHECK(profiler::live_samples() == 0);
+    }
+
+#if defined(POOL_HEAP_PROFILER)
+    SECTION("The allocators sample without the reporter macros")
+    {
+        profiler::reset();
+        profiler::set_sampling_interval(1);
+
+        {
+            std::vector<uint64_t, pool_iostream_reporter<uint64_t>> values;
+            values.reserve(100);
+            CHECK(profiler::live_samples() == 1);
+
+            std::vector<std::vector<int, pool_iostream_reporter<int>>> nested(10);
+            for (auto &v : nested)
+                v.resize(64);
+            CHECK(profiler::live_samples() == 11);
+        }
+        CHECK(profiler::live_samples() == 0);
+    }
+#endif /*POOL_HEAP_PROFILER*/
+
+    profiler::set_sampling_interval(profiler::default_sampling_interval);
+}
+
+TEST_CASE("Allocation trace recording")
+{
+    using recorder = pool::trace_recorder;
+#if defined REPORT_ALLOCATIONS && defined CHECK_MEMORY_LEAK
+    static_assert(pool::allocator_reporter<recorder>);
+#endif /*REPORT_ALLOCATIONS*/
+
+    const auto path = (std::filesystem::temp_directory_path() / "pool_tests_trace.bin").string();
+    REQUIRE(recorder::open(path.c_str()));
+
+    // More events than a ring holds, so the threads write their own rings too
+    constexpr size_t events = pool::trace_recorder::ring_capacity * 3;
+    auto record = [](uintptr_t base) {
+        for (size_t i = 0; i < events; ++i)
+        {
+            recorder::alloc_granted(reinterpret_cast<void *>(base + i * 16), i + 1);
+            recorder::dealloc_request(reinterpret_cast<void *>(base + i * 16), i + 1);
+        }
+    };
+    std::thread first(record, uintptr_t { 0x100000 });
+    std::thread second(record, uintptr_t { 0x10000000 });
+    first.join();
+    second.join();
+    record(0x40000000); // Still in the ring of this thread until close()
+
+    recorder::close();
+    recorder::alloc_granted(reinterpret_cast<void *>(0x10), 8); // Not recorded
+
+    const auto trace = recorder::read(path.c_str());
+    std::filesystem::remove(path);
+    REQUIRE(trace.size() == events * 2 * 3);
+
+    // Every thread has its own id, and its events are in order
+    std::unordered_map<uint32_t, std::vector<pool::trace_record>> threads;
+    for (size_t i = 0; i < trace.size(); ++i)
+    {
+        if (i > 0)
+            CHECK(trace[i - 1].timestamp <= trace[i].timestamp);
+        threads[trace[i].thread].push_back(trace[i]);
+    }
+    REQUIRE(threads.size() == 3);
+
+    for (const auto &[thread, records] : threads)
+    {
+        REQUIRE(records.size() == events * 2);
+        const auto base = records[0].address;
+        for (size_t i = 0; i < events; ++i)
+        {
+            CHECK_FALSE(records[i * 2].deallocation);
+            CHECK(records[i * 2 + 1].deallocation);
+            CHECK(records[i * 2].address == base + i * 16);
+            CHECK(records[i * 2 + 1].address == base + i * 16);
+            CHECK(records[i * 2 + 1].size == i + 1);
+        }
+    }
+}
+
+#if defined(__linux__)
+TEST_CASE("Forking while other threads allocate")
+{
+    global_resource::allocator_type allocator(true, pool::pool_options { .backing = pool::block_backing::mapped });
+
+    std::atomic<bool> stop { false };
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&allocator, &stop, t] {
+            const size_t size = 64 << t;
+            while (!stop.load(std::memory_order_relaxed))
+                allocator.deallocate(allocator.allocate(size), global_resource::allocator_type::adjust_chunk_size(size));
+        });
+    }
+
+    // Without lock_all(), the child could inherit a size class locked by one of the threads
+    for (size_t i = 0; i < 20; ++i)
+    {
+        allocator.lock_all();
+        const pid_t child = fork();
+        allocator.unlock_all();
+
+        if (child == 0)
+        {
+            for (size_t t = 0; t < 4; ++t)
+                allocator.deallocate(allocator.allocate(64 << t), global_resource::allocator_type::adjust_chunk_size(64 << t));
+            _exit(0);
+        }
+
+        int status = -1;
+        REQUIRE(child > 0);
+        REQUIRE(waitpid(child, &status, 0) == child);
+        CHECK(WIFEXITED(status));
+        CHECK(WEXITSTATUS(status) == 0);
+    }
+
+    stop = true;
+    for (auto &thread : threads)
+        thread.join();
+}
+#endif /*__linux__*/
@@ -0,0 +1,103 @@
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// Created by Ricardo Romero on 16/10/26.
+// Copyright (c) 2026 Ricardo Romero.  All rights reserved.
+//
+
+// Runs with libpool_malloc.so preloaded, see the test registered in CMakeLists.txt
+
+#include <catch2/catch_test_macros.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <thread>
+#include <vector>
+
+TEST_CASE("Preloaded malloc")
+{
+    if (std::getenv("LD_PRELOAD") == nullptr)
+    {
+        WARN("libpool_malloc.so isn't preloaded");
+        return;
+    }
+
+    SECTION("Threads created one after the other")
+    {
+        // Every new thread registers the destructor of its cache, which allocates while the allocator is busy.
+        // That memory has to be reused when the thread exits, or the program runs out of it
+        constexpr int threads = 50000;
+
+        int failures = 0;
+        for (int i = 0; i < threads; ++i)
+        {
+            std::thread thread([&failures, i] {
+                auto *p = static_cast<unsigned char *>(std::malloc(static_cast<std::size_t>(i % 1000) + 1));
+                if (p == nullptr)
+                {
+                    ++failures;
+                    return;
+                }
+
+                std::memset(p, 0xab, static_cast<std::size_t>(i % 1000) + 1);
+                std::free(p);
+            });
+            thread.join();
+        }
+
+        REQUIRE(failures == 0);
+    }
+
+    SECTION("Pooled memory has no header")
+    {
+        // The chunk of each size holds it exactly, and the size class of a pointer is found without a header
+        for (std::size_t size : { 16, 64, 128, 1024, 4096 })
+        {
+            auto *p = std::malloc(size);
+            REQUIRE(p != nullptr);
+            CHECK(malloc_usable_size(p) == size);
+            CHECK(reinterpret_cast<uintptr_t>(p) % 16 == 0);
+            std::free(p);
+        }
+
+        // Over-aligned and large memory keeps a header, and the realloc between them copies the contents
+        void *aligned = nullptr;
+        REQUIRE(posix_memalign(&aligned, 16384, 100) == 0);
+        CHECK(reinterpret_cast<uintptr_t>(aligned) % 16384 == 0);
+        CHECK(malloc_usable_size(aligned) >= 100);
+        std::memset(aligned, 0x5a, 100);
+
+        auto *moved = static_cast<unsigned char *>(std::realloc(aligned, 1 << 20));
+        REQUIRE(moved != nullptr);
+        CHECK(moved[99] == 0x5a);
+        moved = static_cast<unsigned char *>(std::realloc(moved, 40));
+        REQUIRE(moved != nullptr);
+        CHECK(moved[39] == 0x5a);
+        CHECK(malloc_usable_size(moved) == 48);
+        std::free(moved);
+    }
+
+    SECTION("Allocations outlive their threads")
+    {
+        std::vector<void *> pointers(64, nullptr);
+        for (int round = 0; round < 100; ++round)
+        {
+            std::vector<std::thread> threads;
+            for (std::size_t i = 0; i < pointers.size(); ++i)
+                threads.emplace_back([&pointers, i] {
+                    std::free(pointers[i]);
+                    pointers[i] = std::calloc(1, 100 + i);
+                });
+
+            for (auto &thread : threads)
+                thread.join();
+        }
+
+        for (std::size_t i = 0; i < pointers.size(); ++i)
+        {
+            REQUIRE(pointers[i] != nullptr);
+            REQUIRE(malloc_usable_size(pointers[i]) >= 100 + i);
+            std::free(pointers[i]);
+        }
+    }
+}
@@ -0,0 +1,301 @@
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// Created by Ricardo Romero on 16/10/26.
+// Copyright (c) 2026 Ricardo Romero.  All rights reserved.
+//
+
+// Replays an allocation trace written by pool::trace_recorder against global_allocator, a memory_pool per size
+// class, and the system malloc, and reports the throughput, the peak RSS and the fragmentation of each one.
+//
+// usage: trace_replay <trace file> [global_allocator] [memory_pool] [malloc]
+//
+// The events of every thread are replayed by a single thread, in the order of their timestamps. Every allocation
+// is written in full, like the traced program would, so the RSS reflects the memory it actually uses
+
+#include "../allocator/allocator.hpp"
+#include "../allocator/pool_reporter.hpp"
+#include "../allocator/trace_recorder.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif /**/
+
+#if defined REPORT_ALLOCATIONS && defined CHECK_MEMORY_LEAK
+using global_allocator = pool::global_allocator<pool::allocator_silent_reporter, pool::pool_silent_reporter>;
+using chunk_pool       = pool::memory_pool<void, pool::pool_silent_reporter, false>;
+#elif !defined(REPORT_ALLOCATIONS) && defined CHECK_MEMORY_LEAK
+using global_allocator = pool::global_allocator<pool::pool_iostream_reporter>;
+using chunk_pool       = pool::memory_pool<void, pool::pool_iostream_reporter, false>;
+#else
+using global_allocator = pool::global_allocator;
+using chunk_pool       = pool::memory_pool<void, false>;
+#endif /*REPORT_ALLOCATIONS*/
+
+namespace
+{
+    /// \brief A traced event, with the allocation it refers to resolved to a slot
+    struct operation
+    {
+        std::size_t slot { 0 };
+        std::size_t size { 0 };
+        bool deallocation { false };
+    };
+
+    struct replay_result
+    {
+        double seconds { 0 };
+        std::size_t peak_rss { 0 }; // Bytes over the RSS before the replay
+    };
+
+    struct malloc_backend
+    {
+        static constexpr const char *name = "malloc";
+
+        auto allocate(std::size_t size) -> void *
+        {
+            return std::malloc(size);
+        }
+
+        auto deallocate(void *p, std::size_t) -> void
+        {
+            std::free(p);
+        }
+    };
+
+    struct global_allocator_backend
+    {
+        static constexpr const char *name = "global_allocator";
+
+        auto allocate(std::size_t size) -> void *
+        {
+            return allocator.allocate(size);
+        }
+
+        auto deallocate(void *p, std::size_t size) -> void
+        {
+            allocator.deallocate(p, global_allocator::adjust_chunk_size(size));
+        }
+
+        global_allocator allocator;
+    };
+
+    /// \brief A memory_pool per size class, without locks nor thread caches. Large allocations use malloc
+    struct memory_pool_backend
+    {
+        static constexpr const char *name = "memory_pool";
+
+        auto allocate(std::size_t size) -> void *
+        {
+            if (size > global_allocator::large_allocation_threshold)
+                return std::malloc(size);
+
+            const auto chunkSize = global_allocator::adjust_chunk_size(size);
+            auto &chunks         = pools[pool::size_classes::index(chunkSize)];
+            if (chunks == nullptr)
+                chunks = std::make_unique<chunk_pool>(global_allocator::usable_size_from_chunk_size(chunkSize), chunkSize);
+
+            return chunks->alloc();
+        }
+
+        auto deallocate(void *p, std::size_t size) -> void
+        {
+            if (size > global_allocator::large_allocation_threshold)
+                std::free(p);
+            else
+                pools[pool::size_classes::index(global_allocator::adjust_chunk_size(size))]->release(p);
+        }
+
+        std::array<std::unique_ptr<chunk_pool>, global_allocator::pooled_classes> pools {};
+    };
+
+    /// \brief Resident memory of the process, or its peak
+    auto resident_bytes(bool peak) -> std::size_t
+    {
+#if defined(__linux__)
+        std::ifstream status("/proc/self/status");
+        const std::string field = peak ? "VmHWM:" : "VmRSS:";
+        for (std::string line; std::getline(status, line);)
+        {
+            if (line.starts_with(field))
+                return std::stoull(line.substr(field.size())) * 1024;
+        }
+        return 0;
+#elif defined(__APPLE__)
+        rusage usage {};
+        getrusage(RUSAGE_SELF, &usage);
+        return peak ? static_cast<std::size_t>(usage.ru_maxrss) : 0;
+#else
+        static_cast<void>(peak);
+        return 0;
+#endif
+    }
+
+    /// \brief Makes the peak RSS of the process start again from the current RSS
+    void reset_peak_rss()
+    {
+#if defined(__linux__)
+        std::ofstream("/proc/self/clear_refs") << "5";
+#endif /*__linux__*/
+    }
+
+    template <typename Backend>
+    auto replay(const std::vector<operation> &operations, std::size_t slots) -> replay_result
+    {
+        auto backend = std::make_unique<Backend>();
+        std::vector<void *> pointers(slots, nullptr);
+
+        reset_peak_rss();
+        const auto baseline = resident_bytes(false);
+        const auto start    = std::chrono::steady_clock::now();
+
+        for (const auto &op : operations)
+        {
+            if (op.deallocation)
+            {
+                backend->deallocate(pointers[op.slot], op.size);
+                continue;
+            }
+
+            auto *p = backend->allocate(op.size);
+            std::memset(p, 1, op.size);
+            pointers[op.slot] = p;
+        }
+
+        const auto end = std::chrono::steady_clock::now();
+
+        replay_result result;
+        result.seconds  = std::chrono::duration<double>(end - start).count();
+        result.peak_rss = resident_bytes(true) > baseline ? resident_bytes(true) - baseline : 0;
+
+        // Free what the trace never freed, so the pools don't report leaks
+        std::vector<bool> freed(slots, false);
+        for (const auto &op : operations)
+        {
+            if (op.deallocation)
+                freed[op.slot] = true;
+        }
+        for (const auto &op : operations)
+        {
+            if (!op.deallocation && !freed[op.slot])
+                backend->deallocate(pointers[op.slot], op.size);
+        }
+
+        return result;
+    }
+
+    template <typename Backend>
+    void report(const std::vector<operation> &operations, std::size_t slots, std::size_t peakLive)
+    {
+        auto run = [&] {
+            const auto result        = replay<Backend>(operations, slots);
+            const auto fragmentation = result.peak_rss > peakLive ? 100.0 * (1.0 - static_cast<double>(peakLive) / static_cast<double>(result.peak_rss)) : 0.0;
+
+            std::printf("%-18s %14.2f %16zu %14.1f%%\n", Backend::name, static_cast<double>(operations.size()) / result.seconds / 1e6, result.peak_rss / 1024, fragmentation);
+            std::fflush(stdout);
+        };
+
+#if defined(__linux__) || defined(__APPLE__)
+        // Each allocator runs in its own process, so they don't share the heap nor the peak RSS
+        std::fflush(stdout);
+        const pid_t child = fork();
+        if (child == 0)
+        {
+            run();
+            _exit(0);
+        }
+        if (child > 0)
+        {
+            waitpid(child, nullptr, 0);
+            return;
+        }
+#endif /**/
+        run();
+    }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "usage: %s <trace file> [global_allocator] [memory_pool] [malloc]\n", argv[0]);
+        return 1;
+    }
+
+    const auto trace = pool::trace_recorder::read(argv[1]);
+    if (trace.empty())
+    {
+        std::fprintf(stderr, "%s is not a trace or it is empty\n", argv[1]);
+        return 1;
+    }
+
+    // Resolve every deallocation to the slot of its allocation, so the replay doesn't look up addresses
+    std::vector<operation> operations;
+    operations.reserve(trace.size());
+    std::unordered_map<uint64_t, operation> live;
+    std::size_t slots     = 0;
+    std::size_t liveBytes = 0;
+    std::size_t peakLive  = 0;
+    std::size_t unmatched = 0;
+    uint32_t threads      = 0;
+    for (const auto &record : trace)
+    {
+        threads = std::max(threads, record.thread + 1);
+
+        if (!record.deallocation)
+        {
+            live[record.address] = { slots, record.size, true };
+            operations.push_back({ slots++, record.size, false });
+            liveBytes += record.size;
+            peakLive = std::max(peakLive, liveBytes);
+            continue;
+        }
+
+        auto it = live.find(record.address);
+        if (it == live.end())
+        {
+            // Allocated before the recording started
+            ++unmatched;
+            continue;
+        }
+
+        // The pools need the size of the allocation
+        operations.push_back(it->second);
+        liveBytes -= it->second.size;
+        live.erase(it);
+    }
+
+    std::printf("trace: %s; events: %zu; threads: %u; unmatched deallocations: %zu; peak live: %zu KiB\n", argv[1], operations.size(), threads, unmatched, peakLive / 1024);
+    std::printf("%-18s %14s %16s %15s\n", "allocator", "Mevents/s", "peak RSS (KiB)", "fragmentation");
+
+    auto selected = [argc, argv](const char *name) {
+        if (argc == 2)
+            return true;
+        for (int i = 2; i < argc; ++i)
+        {
+            if (std::strcmp(argv[i], name) == 0)
+                return true;
+        }
+        return false;
+    };
+
+    if (selected(global_allocator_backend::name))
+        report<global_allocator_backend>(operations, slots, peakLive);
+    if (selected(memory_pool_backend::name))
+        report<memory_pool_backend>(operations, slots, peakLive);
+    if (selected(malloc_backend::name))
+        report<malloc_backend>(operations, slots, peakLive);
+
+    return 0;
+}